@@ -0,0 +1,214 @@
+// Measures how long the cryptographic operations of a client take, apart
+// from the I/O that surrounds them.
+//
+// Covers the generation of key pairs, wrapping and unwrapping symmetric
+// keys with RSA-OAEP, and AES encryption and decryption of payloads from
+// 16 B up to the given maximum size.
+//
+// Every AES case runs twice: once in memory, the way text messages are
+// encrypted, and once through tempfiles, the way files are encrypted from
+// disk and decrypted into a tempfile. The tempfile I/O on its own, without
+// any encryption, is measured next to them.
+//
+// It also reports whether the CPU supports AES-NI, and which implementation
+// Crypto++ picked for AES on this host.
+//
+// usage: crypto_bench.out [max payload size] [key pairs]
+
+#ifdef WIN32
+#include <aes.h>
+#include <cpu.h>
+#elif __linux__
+#include <cryptopp/aes.h>
+#include <cryptopp/cpu.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <tuple>
+
+#include "../crypto/asymmetric.hpp"
+#include "../crypto/symmetric.hpp"
+#include "../protocol/types.hpp"
+#include "../tempfile.hpp"
+
+namespace {
+
+namespace asymmetric = messageu::crypto::asymmetric;
+using messageu::crypto::symmetric::Key;
+using messageu::protocol::types::Content;
+using messageu::tempfile::TempFile;
+
+// Each AES case processes about this many bytes, in as many
+// iterations as it takes, within the limits.
+constexpr std::uintmax_t kBytesPerCase = 64 * 1024 * 1024;
+constexpr std::size_t kMaxIterations = 10000;
+
+// The amount of RSA wraps and unwraps
+constexpr std::size_t kRsaIterations = 2000;
+
+// Runs a function 'count' times, and reports the results.
+// A payload size adds the throughput to the report.
+template <typename Function>
+void run_case(const std::string &name, std::size_t count,
+              std::uintmax_t payload_size, Function run) {
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < count; ++i) run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  auto nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  std::cout << name << ": " << nanoseconds / count << " ns/op";
+  if (payload_size)
+    std::cout << ", "
+              << (static_cast<double>(payload_size) * count / 1024 / 1024) /
+                     (nanoseconds / 1e9)
+              << " MiB/s";
+  std::cout << std::endl;
+}
+
+// A human readable payload size
+std::string size_name(std::uintmax_t size) {
+  if (size >= 1024 * 1024 * 1024)
+    return std::to_string(size / 1024 / 1024 / 1024) + " GiB";
+  if (size >= 1024 * 1024) return std::to_string(size / 1024 / 1024) + " MiB";
+  if (size >= 1024) return std::to_string(size / 1024) + " KiB";
+  return std::to_string(size) + " B";
+}
+
+// Reports the AES instructions of the CPU, and the ones Crypto++ uses
+void report_aes_support() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+  std::cout << "AES-NI: "
+            << (CryptoPP::HasAESNI() ? "supported" : "not supported")
+            << " by the CPU, PCLMULQDQ: "
+            << (CryptoPP::HasCLMUL() ? "supported" : "not supported")
+            << std::endl;
+#else
+  std::cout << "AES-NI: not an x86 CPU" << std::endl;
+#endif
+  std::cout << "Crypto++ AES provider: "
+            << CryptoPP::AES::Encryption().AlgorithmProvider() << std::endl;
+}
+
+void run_asymmetric_cases(std::size_t pairs) {
+  run_case("generate key pair", pairs, 0, []() { asymmetric::Generate(); });
+
+  auto [public_key, private_key] = asymmetric::Generate();
+  auto raw_key = Key().Export();
+  std::string wrapped;
+  public_key.Encrypt(raw_key, wrapped);
+  Content wrapped_content("wrapped");
+  public_key.Encrypt(raw_key, wrapped_content);
+
+  run_case("rsa-oaep wrap, into a buffer", kRsaIterations, 0, [&]() {
+    std::string out;
+    public_key.Encrypt(raw_key, out);
+  });
+  run_case("rsa-oaep wrap, into a content", kRsaIterations, 0, [&]() {
+    Content out("wrapped");
+    public_key.Encrypt(raw_key, out);
+  });
+  run_case("rsa-oaep unwrap, from a buffer", kRsaIterations, 0, [&]() {
+    std::string out;
+    private_key.Decrypt(wrapped, out);
+  });
+  run_case("rsa-oaep unwrap, from a content", kRsaIterations, 0, [&]() {
+    std::string out;
+    private_key.Decrypt(wrapped_content, out);
+  });
+}
+
+void run_symmetric_cases(const Key &key, std::uintmax_t size) {
+  auto count = static_cast<std::size_t>(
+      std::clamp<std::uintmax_t>(kBytesPerCase / size, 1, kMaxIterations));
+  auto name = [size](const std::string &operation) {
+    return "aes " + size_name(size) + " " + operation;
+  };
+
+  // In memory, the way text messages are encrypted
+  {
+    Content::set_memory_threshold(std::numeric_limits<std::size_t>::max());
+    std::string plaintext(size, 'p');
+    Content encrypted("encrypted");
+    key.Encrypt(plaintext, encrypted);
+
+    run_case(name("encrypt, in memory"), count, size, [&]() {
+      Content out("out");
+      out.Reserve(Key::CiphertextSize(size));
+      key.Encrypt(plaintext, out);
+    });
+    run_case(name("decrypt, in memory"), count, size, [&]() {
+      std::string out;
+      out.reserve(size);
+      key.Decrypt(encrypted, out);
+    });
+  }
+
+  // Through tempfiles, the way files are sent and received
+  Content::set_memory_threshold(0);
+  TempFile plaintext_file("plaintext");
+  {
+    std::ofstream plaintext(plaintext_file.path(), std::ofstream::binary);
+    std::string block(std::min<std::uintmax_t>(size, 1024 * 1024), 'p');
+    for (std::uintmax_t left = size; left;) {
+      auto block_size = std::min<std::uintmax_t>(left, block.size());
+      plaintext.write(block.data(), block_size);
+      left -= block_size;
+    }
+  }
+  Content encrypted("encrypted");
+  {
+    std::ifstream plaintext(plaintext_file.path(), std::ifstream::binary);
+    key.Encrypt(plaintext, encrypted);
+  }
+
+  run_case(name("encrypt, via tempfile"), count, size, [&]() {
+    std::ifstream plaintext(plaintext_file.path(), std::ifstream::binary);
+    Content out("out");
+    key.Encrypt(plaintext, out);
+  });
+  run_case(name("decrypt, via tempfile"), count, size, [&]() {
+    TempFile out("decrypted");
+    key.Decrypt(encrypted, out);
+  });
+  // The same reads and writes, without the encryption
+  run_case(name("tempfile i/o only"), count, size, [&]() {
+    std::ifstream plaintext(plaintext_file.path(), std::ifstream::binary);
+    Content copy("copy");
+    std::string block(std::min<std::uintmax_t>(size, 64 * 1024), 0);
+    while (plaintext.read(block.data(), block.size()) || plaintext.gcount())
+      copy.Write(block.data(), plaintext.gcount());
+
+    TempFile out("copied");
+    std::ofstream out_file(out.path(), std::ofstream::binary);
+    copy.Read([&out_file](const char *data, std::size_t size) {
+      out_file.write(data, size);
+    });
+  });
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  std::uintmax_t max_size =
+      argc > 1 ? std::stoull(argv[1]) : 1024 * 1024 * 1024;
+  std::size_t pairs = argc > 2 ? std::stoul(argv[2]) : 10;
+
+  report_aes_support();
+  run_asymmetric_cases(pairs);
+
+  auto memory_threshold = Content::memory_threshold();
+  Key key;
+  for (std::uintmax_t size = 16; size <= max_size; size *= 4)
+    run_symmetric_cases(key, size);
+  Content::set_memory_threshold(memory_threshold);
+
+  return 0;
+}
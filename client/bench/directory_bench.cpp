@@ -0,0 +1,112 @@
+// Measures how fast the session resolves the clients it knows,
+// by their id and by their username.
+//
+// The client directory is compared with the ordered maps the session
+// used before it, with the same clients and the same lookups.
+//
+// usage: directory_bench.out [clients]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../protocol/types.hpp"
+#include "../session/directory.hpp"
+#include "../session/types.hpp"
+
+namespace {
+
+using messageu::protocol::types::ClientID;
+using messageu::session::ClientDirectory;
+using messageu::session::types::Client;
+
+// The amount of lookups each case makes
+constexpr std::size_t kLookups = 1000000;
+
+// Runs a function, and reports the time it took per lookup
+template <typename Function>
+void run_case(const std::string &name, std::size_t count, Function run) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t found = run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << name << ": "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   static_cast<double>(count)
+            << " ns/op (" << found << " found)" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  std::size_t count = argc > 1 ? std::stoul(argv[1]) : 100000;
+
+  // Random ids, and usernames that share long prefixes like real ones do
+  std::mt19937_64 random(42);
+  std::vector<ClientID> ids(count);
+  std::vector<std::string> usernames(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::generate(ids[i].begin(), ids[i].end(),
+                  [&]() { return static_cast<unsigned char>(random()); });
+    usernames[i] = "user_" + std::to_string(i);
+  }
+
+  // The lookups hit the clients in a random order
+  std::vector<std::size_t> order(kLookups);
+  for (auto &index : order) index = random() % count;
+
+  std::cout << count << " clients" << std::endl;
+
+  {
+    std::map<std::string, Client *> username_to_client;
+    std::map<ClientID, Client *> id_to_client;
+    run_case("map insert", count, [&]() {
+      for (std::size_t i = 0; i < count; ++i) {
+        auto *client = new Client(ids[i], usernames[i]);
+        username_to_client[usernames[i]] = client;
+        id_to_client[ids[i]] = client;
+      }
+      return id_to_client.size();
+    });
+    run_case("map find by id", kLookups, [&]() {
+      std::size_t found = 0;
+      for (auto index : order) found += id_to_client.count(ids[index]);
+      return found;
+    });
+    run_case("map find by username", kLookups, [&]() {
+      std::size_t found = 0;
+      for (auto index : order)
+        found += username_to_client.count(usernames[index]);
+      return found;
+    });
+    for (auto &[username, client] : username_to_client) delete client;
+  }
+
+  {
+    ClientDirectory directory;
+    run_case("directory insert", count, [&]() {
+      for (std::size_t i = 0; i < count; ++i)
+        directory.Add(ids[i], usernames[i]);
+      return directory.size();
+    });
+    run_case("directory find by id", kLookups, [&]() {
+      std::size_t found = 0;
+      for (auto index : order) found += directory.Find(ids[index]) != nullptr;
+      return found;
+    });
+    run_case("directory find by username", kLookups, [&]() {
+      std::size_t found = 0;
+      for (auto index : order)
+        found += directory.Find(usernames[index]) != nullptr;
+      return found;
+    });
+  }
+
+  return 0;
+}
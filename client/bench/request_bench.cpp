@@ -0,0 +1,129 @@
+// Measures how requests are serialized into a socket: the time it takes,
+// and the amount of send system calls each request costs.
+//
+// The requests are sent over a loopback connection to a thread that
+// discards whatever it reads. The system calls are counted by wrapping
+// the socket's send calls, so they are only counted on Linux.
+//
+// usage: request_bench.out [requests per case]
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../protocol/request.hpp"
+#include "../protocol/types.hpp"
+
+namespace {
+
+using boost::asio::ip::tcp;
+using namespace messageu::protocol;
+
+// The amount of send system calls the process made so far
+std::atomic<std::uint64_t> send_calls{0};
+
+// Sends the same request over and over, and reports the results.
+void run_case(const std::string &name, const request::Header &request,
+              tcp::socket &socket, std::size_t count) {
+  std::uint64_t start_calls = send_calls;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < count; ++i) request.send(socket);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto calls = send_calls - start_calls;
+
+  std::cout << name << ": "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   count
+            << " ns/request, "
+            << static_cast<double>(calls) / count << " sends/request"
+            << std::endl;
+}
+
+}  // namespace
+
+#ifdef __linux__
+// Boost.Asio and the requests send through these, so wrapping
+// them here counts every system call the requests make.
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags) {
+  ++send_calls;
+  return syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+  ++send_calls;
+  return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+extern "C" ssize_t sendfile(int out_fd, int in_fd, off_t *offset,
+                            size_t count) {
+  ++send_calls;
+  return syscall(SYS_sendfile, out_fd, in_fd, offset, count);
+}
+#endif
+
+int main(int argc, char const *argv[]) {
+  std::size_t count = argc > 1 ? std::stoul(argv[1]) : 10000;
+
+  // Open a loopback connection, and discard everything that is sent
+  boost::asio::io_context io_context;
+  tcp::acceptor acceptor(
+      io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+  tcp::socket socket(io_context);
+  socket.connect(acceptor.local_endpoint());
+  socket.set_option(tcp::no_delay(true));
+  auto peer = acceptor.accept();
+  std::thread discard([&peer]() {
+    std::array<char, 64 * 1024> data;
+    boost::system::error_code error;
+    while (!error) peer.read_some(boost::asio::buffer(data), error);
+  });
+
+  types::ClientID id{0};
+  types::Username username{'b', 'e', 'n', 'c', 'h'};
+  types::PublicKey public_key{0};
+  run_case("register", request::Register(username, public_key), socket, count);
+  run_case("client list", request::ClientList(id), socket, count);
+  run_case("public key", request::GetPublicKey(id, id), socket, count);
+
+  types::Content text("bench_text");
+  std::string data(128, 'x');
+  text.Write(data.data(), data.size());
+  run_case("send text",
+           request::SendMessage(id, id, types::MessageTypes::TextMessage, text),
+           socket, count);
+
+  // a content that spills into its dump file
+  types::Content file("bench_file");
+  data.assign(types::Content::memory_threshold() + 1, 'x');
+  file.Write(data.data(), data.size());
+  run_case("send stored file",
+           request::SendMessage(id, id, types::MessageTypes::File, file),
+           socket, count / 10);
+
+  run_case("send produced file",
+           request::SendMessage(
+               id, id, types::MessageTypes::File, data.size(),
+               [&data](const types::ContentWriter &write) {
+                 for (std::size_t i = 0; i < data.size(); i += 16)
+                   write(data.data() + i, std::min<std::size_t>(
+                                              16, data.size() - i));
+               }),
+           socket, count / 10);
+
+  socket.shutdown(tcp::socket::shutdown_send);
+  discard.join();
+  return 0;
+}
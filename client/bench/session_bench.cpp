@@ -0,0 +1,352 @@
+// Measures the latency and the throughput of the requests a session makes,
+// against a real server on a loopback connection.
+//
+// The Python server is started from the given directory, on a free port,
+// with a fresh database in a temporary directory. Given an <ip>:<port>,
+// the benchmark talks to an already running server instead.
+//
+// Every case runs with a few client counts, each client with its own
+// session and thread, all of them sending requests at once. Text messages
+// are sent in several sizes, each client to the next one, and every round
+// of messages is retrieved by its receivers before the next one is sent.
+// Registering includes the generation of the client's RSA keys.
+//
+// The settings are added to the server info of the sessions, to compare
+// keep-alive connections with a connection per request, for example.
+//
+// usage: session_bench.out [server directory | <ip>:<port>]
+//                          [requests per case] [<key>=<value> ...]
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../config.hpp"
+#include "../protocol/types.hpp"
+#include "../session/session.hpp"
+
+namespace {
+
+namespace fs = std::filesystem;
+using boost::asio::ip::tcp;
+using messageu::config::ServerInfo;
+using messageu::session::Session;
+using Clock = std::chrono::steady_clock;
+
+// A client needs a peer, the server does not list a client to itself
+constexpr std::size_t kClientCounts[] = {2, 4, 16, 64};
+constexpr std::size_t kMessageSizes[] = {16, 1024, 64 * 1024, 1024 * 1024};
+
+// The amount of messages each client sends before they're retrieved
+constexpr std::size_t kMessagesPerRound = 10;
+
+// Large messages are sent fewer times, about as many bytes as this
+// amount of 16 KiB messages.
+constexpr std::size_t kMessageBlocks = 16 * 1024;
+
+// The latencies of the requests of a case, and the time they took
+struct Samples {
+  std::vector<double> latencies;  // in microseconds
+  Clock::duration elapsed{0};
+  std::uintmax_t bytes = 0;
+};
+
+// Sends 'count' requests from every client at once, a thread per client,
+// and adds the latency of each request to the samples.
+void run_phase(std::size_t clients, std::size_t count,
+               const std::function<void(std::size_t client)> &request,
+               Samples &samples) {
+  std::vector<std::vector<double>> latencies(clients);
+  std::vector<std::exception_ptr> errors(clients);
+  std::vector<std::thread> threads;
+
+  auto start = Clock::now();
+  for (std::size_t client = 0; client < clients; ++client)
+    threads.emplace_back([&, client]() {
+      try {
+        for (std::size_t i = 0; i < count; ++i) {
+          auto request_start = Clock::now();
+          request(client);
+          latencies[client].push_back(std::chrono::duration<double, std::micro>(
+                                          Clock::now() - request_start)
+                                          .count());
+        }
+      } catch (...) {
+        errors[client] = std::current_exception();
+      }
+    });
+  for (auto &thread : threads) thread.join();
+  samples.elapsed += Clock::now() - start;
+
+  for (auto &error : errors)
+    if (error) std::rethrow_exception(error);
+  for (auto &client_latencies : latencies)
+    samples.latencies.insert(samples.latencies.end(), client_latencies.begin(),
+                             client_latencies.end());
+}
+
+// Reports the percentiles of the latencies, and the throughput
+void report(const std::string &name, Samples &samples) {
+  auto &latencies = samples.latencies;
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double rank) {
+    return static_cast<std::uintmax_t>(
+        latencies[static_cast<std::size_t>(rank * (latencies.size() - 1))]);
+  };
+  auto seconds = std::chrono::duration<double>(samples.elapsed).count();
+
+  std::cout << name << ": p50 " << percentile(0.5) << " us, p90 "
+            << percentile(0.9) << " us, p99 " << percentile(0.99)
+            << " us, max " << percentile(1) << " us, "
+            << static_cast<std::uintmax_t>(latencies.size() / seconds)
+            << " requests/s";
+  if (samples.bytes)
+    std::cout << ", " << samples.bytes / 1024.0 / 1024 / seconds << " MiB/s";
+  std::cout << std::endl;
+}
+
+// Runs all the cases with the given amount of clients
+void run_cases(const ServerInfo &server_info, const fs::path &work_dir,
+               const std::string &tag, std::size_t clients,
+               std::size_t count) {
+  std::cout << "== " << clients << " clients ==" << std::endl;
+
+  std::vector<Session *> sessions;
+  std::vector<std::string> usernames;
+  for (std::size_t client = 0; client < clients; ++client) {
+    sessions.push_back(new Session(server_info));
+    usernames.push_back("bench_" + tag + "_" + std::to_string(clients) + "_" +
+                        std::to_string(client));
+  }
+  // every client talks to the next one
+  auto peer = [&](std::size_t client) {
+    return usernames[(client + 1) % clients];
+  };
+
+  try {
+    Samples registered;
+    run_phase(
+        clients, 1,
+        [&](std::size_t client) {
+          sessions[client]->Register(
+              usernames[client], work_dir / (usernames[client] + ".info"));
+        },
+        registered);
+    report("register", registered);
+
+    Samples listed;
+    run_phase(
+        clients, count,
+        [&](std::size_t client) {
+          sessions[client]->UpdateClientList([](const std::string &) {});
+        },
+        listed);
+    report("client list", listed);
+
+    Samples public_keys;
+    run_phase(
+        clients, count,
+        [&](std::size_t client) {
+          sessions[client]->GetPublicKey(peer(client));
+        },
+        public_keys);
+    report("public key", public_keys);
+
+    // Exchange the symmetric keys the messages are encrypted with
+    Samples unused;
+    run_phase(
+        clients, 1,
+        [&](std::size_t client) {
+          sessions[client]->SendSymmetricKey(peer(client));
+        },
+        unused);
+    run_phase(
+        clients, 1,
+        [&](std::size_t client) {
+          sessions[client]->RetrievePendingMessages(
+              [](const messageu::session::types::Message &) {});
+        },
+        unused);
+
+    for (auto message_size : kMessageSizes) {
+      std::string text(message_size, 't');
+      auto rounds =
+          std::max<std::size_t>(1, count * kMessageBlocks / message_size /
+                                       kMessagesPerRound);
+      rounds = std::min(rounds, std::max<std::size_t>(
+                                    1, count / kMessagesPerRound));
+
+      Samples sent, retrieved;
+      std::atomic<std::size_t> received{0};
+      for (std::size_t round = 0; round < rounds; ++round) {
+        run_phase(
+            clients, kMessagesPerRound,
+            [&](std::size_t client) {
+              sessions[client]->SendMessage(peer(client), text);
+            },
+            sent);
+        run_phase(
+            clients, 1,
+            [&](std::size_t client) {
+              sessions[client]->RetrievePendingMessages(
+                  [&received](const messageu::session::types::Message &) {
+                    ++received;
+                  });
+            },
+            retrieved);
+      }
+
+      auto messages = rounds * kMessagesPerRound * clients;
+      if (received != messages)
+        throw std::runtime_error("retrieved " + std::to_string(received) +
+                                 " messages out of " +
+                                 std::to_string(messages));
+      sent.bytes = retrieved.bytes = messages * message_size;
+      report("send text " + std::to_string(message_size) + " B", sent);
+      report("retrieve " + std::to_string(kMessagesPerRound) + " x " +
+                 std::to_string(message_size) + " B",
+             retrieved);
+    }
+  } catch (...) {
+    for (auto session : sessions) delete session;
+    throw;
+  }
+  for (auto session : sessions) delete session;
+}
+
+// Finds a port that is free right now, the server info only accepts
+// ports of up to 4 digits.
+unsigned short free_port() {
+  boost::asio::io_context io_context;
+  std::mt19937 random(std::random_device{}());
+  std::uniform_int_distribution<unsigned short> ports(2000, 9999);
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    tcp::acceptor acceptor(io_context);
+    boost::system::error_code error;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(),
+                           ports(random));
+    acceptor.open(endpoint.protocol());
+    acceptor.bind(endpoint, error);
+    if (!error) return endpoint.port();
+  }
+  throw std::runtime_error("could not find a free port");
+}
+
+// Waits until the server accepts connections
+void wait_for_server(unsigned short port) {
+  boost::asio::io_context io_context;
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    tcp::socket socket(io_context);
+    boost::system::error_code error;
+    socket.connect(
+        tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), error);
+    if (!error) return;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  throw std::runtime_error("the server did not start");
+}
+
+#ifdef __linux__
+// Starts the server from its directory, in the work directory,
+// and returns its process id.
+pid_t start_server(const fs::path &server_dir, const fs::path &work_dir,
+                   unsigned short port) {
+  std::ofstream(work_dir / "myport.info") << port;
+  auto main_path = fs::absolute(server_dir / "main.py");
+  if (!fs::exists(main_path))
+    throw std::invalid_argument("could not find the server at " +
+                                main_path.string());
+
+  auto pid = fork();
+  if (pid == -1) throw std::runtime_error("could not start the server");
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    if (chdir(work_dir.c_str()) == 0)
+      execlp("python3", "python3", main_path.c_str(), nullptr);
+    _exit(127);
+  }
+  return pid;
+}
+
+void stop_server(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+}
+#endif
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  std::string server = argc > 1 ? argv[1] : "../server";
+  std::size_t count = argc > 2 ? std::stoul(argv[2]) : 200;
+
+  auto tag = std::to_string(
+      std::chrono::system_clock::now().time_since_epoch().count() % 1000000);
+  auto work_dir = fs::temp_directory_path() / ("session_bench_" + tag);
+  fs::create_directories(work_dir);
+
+  // A directory starts a server of our own, an address is used as it is
+  std::string address = server;
+  bool own_server = server.find(':') == std::string::npos;
+#ifdef __linux__
+  pid_t server_pid = 0;
+#endif
+  if (own_server) {
+#ifdef __linux__
+    auto port = free_port();
+    server_pid = start_server(server, work_dir, port);
+    wait_for_server(port);
+    address = "127.0.0.1:" + std::to_string(port);
+#else
+    std::cerr << "start the server, and pass its <ip>:<port>" << std::endl;
+    return 1;
+#endif
+  }
+
+  int status = 0;
+  try {
+    std::ofstream info_file(work_dir / "server.info");
+    info_file << address << std::endl;
+    for (int i = 3; i < argc; ++i) info_file << argv[i] << std::endl;
+    info_file.close();
+
+    ServerInfo server_info(work_dir / "server.info");
+    messageu::protocol::types::Content::set_memory_threshold(
+        server_info.memory_threshold());
+    messageu::protocol::types::set_block_size(server_info.block_size());
+
+    std::cout << count << " requests per case against " << address
+              << std::endl;
+    for (auto clients : kClientCounts)
+      run_cases(server_info, work_dir, tag, clients, count);
+  } catch (const std::exception &err) {
+    std::cerr << "the benchmark failed: " << err.what() << std::endl;
+    status = 1;
+  }
+
+#ifdef __linux__
+  if (own_server) stop_server(server_pid);
+#endif
+  fs::remove_all(work_dir);
+  return status;
+}
@@ -0,0 +1,116 @@
+// Measures the throughput of encrypting and decrypting short messages
+// with the same key, the way a client talks to the same peers over and
+// over.
+//
+// A key prepares its ciphers once, and reuses them for every message.
+// The setup it replaced, that prepared them again for each message,
+// is measured next to it for comparison.
+//
+// usage: symmetric_bench.out [messages per case] [message size]
+
+#ifdef WIN32
+#include <aes.h>
+#include <filters.h>
+#include <modes.h>
+#elif __linux__
+#include <cryptopp/aes.h>
+#include <cryptopp/filters.h>
+#include <cryptopp/modes.h>
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "../crypto/content.hpp"
+#include "../crypto/symmetric.hpp"
+#include "../protocol/types.hpp"
+
+namespace {
+
+using messageu::crypto::symmetric::Key;
+using messageu::crypto::symmetric::kKeySize;
+using messageu::protocol::types::Content;
+using messageu::protocol::types::ContentWriter;
+
+// Runs a function for each message, and reports the results.
+template <typename Function>
+void run_case(const std::string &name, std::size_t count,
+              std::size_t message_size, Function run) {
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < count; ++i) run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  auto nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  std::cout << name << ": " << nanoseconds / count << " ns/message, "
+            << (static_cast<double>(message_size) * count / 1024 / 1024) /
+                   (nanoseconds / 1e9)
+            << " MiB/s" << std::endl;
+}
+
+// Encrypts a message the way every message used to be encrypted,
+// by preparing the ciphers from the raw key.
+void encrypt_unprepared(const std::string &raw_key, const std::string &in,
+                        Content &out) {
+  CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE]{0};
+  CryptoPP::AES::Encryption aesEncryption(
+      reinterpret_cast<const CryptoPP::byte *>(raw_key.data()), kKeySize);
+  CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption,
+                                                              iv);
+
+  CryptoPP::StringSource{
+      in, true,
+      new CryptoPP::StreamTransformationFilter{
+          cbcEncryption, new messageu::crypto::ContentSink(out)}};
+}
+
+// Decrypts a message the way every message used to be decrypted
+void decrypt_unprepared(const std::string &raw_key, const Content &in,
+                        std::string &out) {
+  CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE]{0};
+  CryptoPP::AES::Decryption aesDecryption(
+      reinterpret_cast<const CryptoPP::byte *>(raw_key.data()), kKeySize);
+  CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption,
+                                                              iv);
+
+  CryptoPP::StreamTransformationFilter filter{cbcDecryption,
+                                              new CryptoPP::StringSink(out)};
+  messageu::crypto::PumpContent(in, filter);
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  std::size_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+  std::size_t message_size = argc > 2 ? std::stoul(argv[2]) : 64;
+
+  Key key;
+  auto raw_key = key.Export();
+  std::string message(message_size, 'm');
+  Content encrypted("encrypted");
+  key.Encrypt(message, encrypted);
+
+  std::cout << count << " messages of " << message_size << " bytes"
+            << std::endl;
+
+  run_case("encrypt, prepared per message", count, message_size, [&]() {
+    Content out("out");
+    encrypt_unprepared(raw_key, message, out);
+  });
+  run_case("encrypt, prepared once", count, message_size, [&]() {
+    Content out("out");
+    key.Encrypt(message, out);
+  });
+  run_case("decrypt, prepared per message", count, message_size, [&]() {
+    std::string out;
+    decrypt_unprepared(raw_key, encrypted, out);
+  });
+  run_case("decrypt, prepared once", count, message_size, [&]() {
+    std::string out;
+    key.Decrypt(encrypted, out);
+  });
+
+  return 0;
+}
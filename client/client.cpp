@@ -1,6 +1,13 @@
 #include "client.hpp"
 
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
 #include "config.hpp"
+#include "metrics.hpp"
 #include "protocol/exceptions.hpp"
 #include "session/exceptions.hpp"
 #include "session/session.hpp"
@@ -10,36 +17,82 @@ namespace messageu {
 
 namespace {
 // boilerplate code
-void mask_request(std::ostream& output, std::function<void()> callback) {
+//
+// A batch should count the failed requests, so the errors are rethrown
+// instead of displayed, when asked to.
+void mask_request(std::ostream& output, bool rethrow,
+                  std::function<void()> callback) {
   try {
     callback();
   } catch (const session::exceptions::GeneralError& e) {
+    if (rethrow) throw;
     output << e.what();
   } catch (const protocol::exceptions::GeneralException& e) {
+    if (rethrow) throw;
     output << e.what();
   }
 }
+
+// Splits a list of usernames that are separated by commas,
+// the spaces around each username are ignored.
+std::vector<std::string> split_usernames(const std::string& line) {
+  std::vector<std::string> usernames;
+  std::size_t start = 0;
+  while (start <= line.size()) {
+    auto end = std::min(line.find(',', start), line.size());
+    auto first = line.find_first_not_of(' ', start);
+    auto last = line.find_last_not_of(' ', end - 1);
+    if (first < end && last != std::string::npos && last >= first)
+      usernames.push_back(line.substr(first, last - first + 1));
+    start = end + 1;
+  }
+  return usernames;
+}
 }  // namespace
 
-void start_client() {
-  session::Session client_session(config::ServerInfo(kServerInfoFile),
-                                  kClientInfoFile);
+bool start_client(std::istream* batch) {
+  config::ServerInfo server_info(kServerInfoFile);
+  protocol::types::Content::set_memory_threshold(
+      server_info.memory_threshold());
+  protocol::types::set_block_size(server_info.block_size());
+  // The ui outlives the session, whose subscription displays through it
   ui::UI ui("MessageU client at your service");
+  session::Session client_session(server_info, kClientInfoFile);
   std::function<void(std::ostream&)> callback;
+  const bool in_batch = batch != nullptr;
+
+  // Every command refreshes the metrics file, if there is one
+  auto metrics_file = server_info.metrics_file();
+  auto register_cmd = [&](std::size_t trigger, const std::string& title,
+                          std::function<void(std::ostream&)> callback,
+                          std::size_t fields = 0) {
+    ui.RegisterCmd(
+        trigger, title,
+        [&, callback](std::ostream& ostream) {
+          callback(ostream);
+          if (metrics_file.empty()) return;
+          try {
+            metrics::WriteSnapshot(metrics_file);
+          } catch (const std::exception& e) {
+            ostream << "\nCould not write the metrics: " << e.what();
+          }
+        },
+        fields);
+  };
 
   // Register
   callback = [&](std::ostream& ostream) {
     std::string username = ui.ReadLine("Enter username: ");
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       client_session.Register(username, kClientInfoFile);
       ostream << "Registered successfully!";
     });
   };
-  ui.RegisterCmd(kRegisterCode, kRegisterTitle, callback);
+  register_cmd(kRegisterCode, kRegisterTitle, callback, 1);
 
   // Poll memberlist
   callback = [&](std::ostream& ostream) {
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       size_t client_count = 0;
       client_session.UpdateClientList([&](const std::string& username) {
         ostream << ++client_count << ". \"" << username << "\"\n";
@@ -47,22 +100,22 @@ void start_client() {
       if (!client_count) ostream << "There are no other registered clients";
     });
   };
-  ui.RegisterCmd(kMemberListCode, kMemberListTitle, callback);
+  register_cmd(kMemberListCode, kMemberListTitle, callback);
 
   // Request public key
   callback = [&](std::ostream& ostream) {
     std::string target_username = ui.ReadLine("Enter the target's username: ");
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       client_session.GetPublicKey(target_username);
       ostream << "Received " << target_username
               << "\'s public key, successfully!";
     });
   };
-  ui.RegisterCmd(kRequestPublicKeyCode, kRequestPublicKeyTitle, callback);
+  register_cmd(kRequestPublicKeyCode, kRequestPublicKeyTitle, callback, 1);
 
   // Poll pending messages
   callback = [&](std::ostream& ostream) {
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       size_t message_count = 0;
       client_session.RetrievePendingMessages(
           [&](const session::types::Message& message) {
@@ -72,54 +125,93 @@ void start_client() {
       if (!message_count) ostream << "There are no pending messages";
     });
   };
-  ui.RegisterCmd(kRetreivePendingMessagesCode, kRetreivePendingMessagesTitle,
+  register_cmd(kRetreivePendingMessagesCode, kRetreivePendingMessagesTitle,
                  callback);
 
+  // Show messages as they arrive, from a background thread
+  callback = [&](std::ostream& ostream) {
+    if (client_session.subscribed()) {
+      client_session.Unsubscribe();
+      ostream << "New messages are no longer shown as they arrive";
+      return;
+    }
+    mask_request(ostream, in_batch, [&]() {
+      client_session.Subscribe([&](const session::types::Message& message) {
+        std::ostringstream text;
+        text << message;
+        ui.Notify(text.str());
+      });
+      ostream << "New messages will be shown as they arrive";
+    });
+  };
+  register_cmd(kSubscribeCode, kSubscribeTitle, callback);
+
   // Send text message
   callback = [&](std::ostream& ostream) {
     std::string target_username = ui.ReadLine("Enter the target's username: ");
     std::string message = ui.ReadLine("Enter your message: ");
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       client_session.SendMessage(target_username, message);
       ostream << "The message has been sent successfully";
     });
   };
-  ui.RegisterCmd(kSendTextMessageCode, kSendTextMessageTitle, callback);
+  register_cmd(kSendTextMessageCode, kSendTextMessageTitle, callback, 2);
 
   // Request symmetric key
   callback = [&](std::ostream& ostream) {
     std::string target_username = ui.ReadLine("Enter the target's username: ");
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       client_session.RequestSymmetricKey(target_username);
       ostream << "Request for " << target_username
               << "\'s symmetric key has been sent successfully";
     });
   };
-  ui.RegisterCmd(kRequestSymmerticKeyCode, kRequestSymmerticKeyTitle, callback);
+  register_cmd(kRequestSymmerticKeyCode, kRequestSymmerticKeyTitle, callback,
+               1);
 
   // Send symmetric key
   callback = [&](std::ostream& ostream) {
     std::string target_username = ui.ReadLine("Enter the target's username: ");
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       client_session.SendSymmetricKey(target_username);
       ostream << "Symmetric key has been sent successfully";
     });
   };
-  ui.RegisterCmd(kSendSymmetricKeyCode, kSendSymmetricKeyTitle, callback);
+  register_cmd(kSendSymmetricKeyCode, kSendSymmetricKeyTitle, callback, 1);
 
   // Send file
   callback = [&](std::ostream& ostream) {
     std::string target_username = ui.ReadLine("Enter the target's username: ");
     std::string file_path =
         ui.ReadLine("Enter file path (relative to client or absolute): ");
-    mask_request(ostream, [&]() {
+    mask_request(ostream, in_batch, [&]() {
       client_session.SendFile(target_username, file_path);
       ostream << "The file has been sent successfully";
     });
   };
-  ui.RegisterCmd(kSendFileCode, kSendFileTitle, callback);
+  register_cmd(kSendFileCode, kSendFileTitle, callback, 2);
+
+  // Send text message to several clients
+  callback = [&](std::ostream& ostream) {
+    auto target_usernames = split_usernames(
+        ui.ReadLine("Enter the targets' usernames, separated by commas: "));
+    std::string message = ui.ReadLine("Enter your message: ");
+    mask_request(ostream, in_batch, [&]() {
+      client_session.SendMessageToMany(target_usernames, message);
+      ostream << "The message has been sent successfully to "
+              << target_usernames.size() << " clients";
+    });
+  };
+  register_cmd(kSendTextMessageToManyCode, kSendTextMessageToManyTitle,
+                 callback, 2);
+
+  // Show the metrics
+  callback = [&](std::ostream& ostream) { ostream << metrics::Snapshot(); };
+  register_cmd(kShowMetricsCode, kShowMetricsTitle, callback);
 
+  if (batch) return !ui.RunBatch(*batch, kExitCode);
   ui.Run(kExitCode);
+  return true;
 }
 
 }  // namespace messageu
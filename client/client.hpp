@@ -24,6 +24,10 @@ constexpr char kRequestPublicKeyTitle[] = "Request for public key";
 constexpr std::size_t kRetreivePendingMessagesCode = 140;
 constexpr char kRetreivePendingMessagesTitle[] = "Request for waiting messages";
 
+constexpr std::size_t kSubscribeCode = 141;
+constexpr char kSubscribeTitle[] =
+    "Show messages as they arrive (toggles on / off)";
+
 constexpr std::size_t kSendTextMessageCode = 150;
 constexpr char kSendTextMessageTitle[] = "Send a text message";
 
@@ -36,8 +40,18 @@ constexpr char kSendSymmetricKeyTitle[] = "Send your symmetric key";
 constexpr std::size_t kSendFileCode = 153;
 constexpr char kSendFileTitle[] = "Send a file";
 
+constexpr std::size_t kSendTextMessageToManyCode = 154;
+constexpr char kSendTextMessageToManyTitle[] =
+    "Send a text message to several clients";
+
+constexpr std::size_t kShowMetricsCode = 160;
+constexpr char kShowMetricsTitle[] = "Show the client metrics";
+
 // Starts the client
-void start_client();
+//
+// Given a batch, runs its cmds instead of the menu (see ui::UI::RunBatch),
+// all in the same session, and returns whether all of them succeeded.
+bool start_client(std::istream *batch = nullptr);
 
 }  // namespace messageu
 
@@ -11,6 +11,22 @@
 namespace messageu {
 namespace config {
 
+namespace {
+// More threads than that won't find messages to decrypt
+constexpr std::size_t kMaxDecryptWorkers = 64;
+
+// Parses a non-negative size setting
+std::size_t parse_size(const std::string &key, const std::string &value) {
+  if (value.find_first_not_of("0123456789") != std::string::npos)
+    throw std::invalid_argument(key + " must be a non-negative number");
+  try {
+    return std::stoull(value);
+  } catch (const std::out_of_range &) {
+    throw std::invalid_argument(key + " is too big");
+  }
+}
+}  // namespace
+
 ServerInfo::ServerInfo(const std::filesystem::path &file_path) {
   // Regex pattern that matches <ip>:<port>
   const static std::regex ip_pattern(
@@ -33,6 +49,50 @@ ServerInfo::ServerInfo(const std::filesystem::path &file_path) {
   } else
     throw std::invalid_argument("could not read the server info from " +
                                 file_path.string());
+
+  // Regex pattern that matches <key>=<value>
+  const static std::regex setting_pattern(
+      R"(^\s{0,}(\w+)\s{0,}=\s{0,}(\S+)\s{0,}$)");
+  while (std::getline(info_file, content)) {
+    if (content.find_first_not_of(" \t\r") == std::string::npos)
+      continue;  // skip empty lines
+    if (!std::regex_match(content, base_match, setting_pattern))
+      throw std::invalid_argument("could not parse the setting \"" + content +
+                                  "\" from " + file_path.string());
+    ApplySetting(base_match[1], base_match[2]);
+  }
+}
+
+void ServerInfo::ApplySetting(const std::string &key,
+                              const std::string &value) {
+  if (key == "keep_alive") {
+    if (value != "0" && value != "1")
+      throw std::invalid_argument("keep_alive must be either 0 or 1");
+    keep_alive_ = value == "1";
+  } else if (key == "memory_threshold") {
+    memory_threshold_ = parse_size(key, value);
+  } else if (key == "decrypt_workers") {
+    decrypt_workers_ = parse_size(key, value);
+    if (decrypt_workers_ > kMaxDecryptWorkers)
+      throw std::invalid_argument("decrypt_workers must be at most " +
+                                  std::to_string(kMaxDecryptWorkers));
+  } else if (key == "block_size") {
+    if (value == "auto") {
+      block_size_ = 0;
+      return;
+    }
+    block_size_ = parse_size(key, value);
+    if (block_size_ < protocol::types::kMinBlockSize ||
+        block_size_ > protocol::types::kMaxBlockSize)
+      throw std::invalid_argument(
+          "block_size must be auto, or between " +
+          std::to_string(protocol::types::kMinBlockSize) + " and " +
+          std::to_string(protocol::types::kMaxBlockSize));
+  } else if (key == "metrics_file") {
+    metrics_file_ = value;
+  } else {
+    throw std::invalid_argument("unknown server setting: " + key);
+  }
 }
 
 MyInfo::MyInfo(const std::string username, protocol::types::ClientID id,
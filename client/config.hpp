@@ -16,6 +16,20 @@ namespace config {
 class ServerInfo {
  public:
   // Loads the info from a file
+  //
+  // The first line holds the server address (<ip>:<port>),
+  // every following line may hold an optional setting (<key>=<value>):
+  //  keep_alive: [0/1] reuse connections between requests.
+  //  memory_threshold: [bytes] the size up to which a message content
+  //    is held in memory, instead of a temporary file.
+  //  decrypt_workers: [count] the amount of threads that decrypt pending
+  //    messages while more are downloaded, 0 decrypts them one by one
+  //    as they're downloaded.
+  //  block_size: [bytes/auto] the size of the blocks contents are sent
+  //    and received in, auto picks it from the socket buffers.
+  //  metrics_file: [path] a file the client writes a snapshot of its
+  //    metrics to after every command, for a scraper to read.
+  //
   // Throws:
   // std::invalid_argument if it can not open the file,
   //    or fails to read the info from the file.
@@ -23,10 +37,28 @@ class ServerInfo {
 
   const std::string &ip() { return ip_; };
   const std::string &port() { return port_; };
+  bool keep_alive() { return keep_alive_; };
+  std::size_t memory_threshold() { return memory_threshold_; };
+  std::size_t decrypt_workers() { return decrypt_workers_; };
+  // Zero when it should be picked from the socket buffers
+  std::size_t block_size() { return block_size_; };
+  // Empty when the metrics aren't written to a file
+  const std::filesystem::path &metrics_file() { return metrics_file_; };
 
  private:
+  // Applies a single optional setting
+  //
+  // Throws std::invalid_argument if the setting is unknown,
+  // or its value can not be parsed.
+  void ApplySetting(const std::string &key, const std::string &value);
+
   std::string ip_;
   std::string port_;
+  bool keep_alive_ = false;
+  std::size_t memory_threshold_ = protocol::types::kDefaultMemoryThreshold;
+  std::size_t block_size_ = protocol::types::kDefaultBlockSize;
+  std::size_t decrypt_workers_ = 0;
+  std::filesystem::path metrics_file_;
 };
 
 class MyInfo {
@@ -14,47 +14,82 @@
 #include <cryptopp/rsa.h>
 #endif
 
-#include <fstream>
 #include <tuple>
 
+#include "../metrics.hpp"
+#include "content.hpp"
+
 namespace messageu {
 namespace crypto {
 namespace asymmetric {
 
 using CryptoPP::byte;
 
+namespace {
+// The random pool is seeded once per thread, instead of once per key
+CryptoPP::RandomNumberGenerator& random_pool() {
+  thread_local CryptoPP::AutoSeededRandomPool rng;
+  return rng;
+}
+
+CryptoPP::RSA::PrivateKey load_private_key(const std::string& key) {
+  CryptoPP::RSA::PrivateKey private_key;
+  CryptoPP::StringSource ss(key, true);
+  private_key.Load(ss);
+  return private_key;
+}
+}  // namespace
+
 PublicKey::PublicKey(protocol::types::PublicKey public_key) {
+  CryptoPP::RSA::PublicKey loaded_key;
   CryptoPP::StringSource ss(reinterpret_cast<const byte*>(public_key.data()),
                             public_key.size(), true);
-  public_key_.Load(ss);
+  loaded_key.Load(ss);
+  prepared_ = new Prepared(loaded_key);
+}
+
+PublicKey::PublicKey(const PublicKey& other) : prepared_(other.prepared_) {
+  ++prepared_->reference_count;
+}
+
+PublicKey::~PublicKey() {
+  if (!(--prepared_->reference_count)) delete prepared_;
 }
 
 protocol::types::PublicKey PublicKey::Export() {
   protocol::types::PublicKey public_key{0};
   CryptoPP::ArraySink as(reinterpret_cast<byte*>(public_key.data()),
                          public_key.size());
-  public_key_.Save(as);
+  prepared_->public_key.Save(as);
   return public_key;
 }
 
-void PublicKey::Encrypt(const tempfile::TempFile& in,
-                        const tempfile::TempFile& out) const {
-  CryptoPP::AutoSeededRandomPool rng;
-  CryptoPP::RSAES_OAEP_SHA_Encryptor e(public_key_);
-
-  std::ifstream in_stream(in.path(), std::ios::binary);
-  std::ofstream out_stream(out.path(), std::ios::binary);
-
-  CryptoPP::FileSource{in_stream, true,
-                       new CryptoPP::PK_EncryptorFilter{
-                           rng, e, new CryptoPP::FileSink(out_stream)}};
+void PublicKey::Encrypt(const std::string& in, std::string& out) const {
+  metrics::Timer timer(metrics::Phase::kAsymmetricEncrypt);
+  timer.add_bytes(in.size());
+  auto& encryptor = prepared_->encryptor;
+  if (in.size() > encryptor.FixedMaxPlaintextLength())
+    throw CryptoPP::InvalidArgument("the buffer is too long for the key");
+
+  auto offset = out.size();
+  out.resize(offset + encryptor.CiphertextLength(in.size()));
+  encryptor.Encrypt(random_pool(), reinterpret_cast<const byte*>(in.data()),
+                    in.size(), reinterpret_cast<byte*>(&out[offset]));
 }
 
-PrivateKey::PrivateKey(const std::string& key) {
-  CryptoPP::StringSource ss(key, true);
-  private_key_.Load(ss);
+void PublicKey::Encrypt(const std::string& in,
+                        protocol::types::Content& out) const {
+  std::string encrypted;
+  Encrypt(in, encrypted);
+  out.Write(encrypted.data(), encrypted.size());
 }
 
+PrivateKey::PrivateKey(const std::string& key)
+    : private_key_(load_private_key(key)), decryptor_(private_key_) {}
+
+PrivateKey::PrivateKey(const PrivateKey& other)
+    : private_key_(other.private_key_), decryptor_(private_key_) {}
+
 std::string PrivateKey::Export() {
   std::string exported_key;
   CryptoPP::StringSink as(exported_key);
@@ -62,20 +97,37 @@ std::string PrivateKey::Export() {
   return exported_key;
 }
 
-void PrivateKey::Decrypt(const tempfile::TempFile& in,
-                         const tempfile::TempFile& out) const {
-  static CryptoPP::AutoSeededRandomPool rng;
-  CryptoPP::RSAES_OAEP_SHA_Decryptor d(private_key_);
+void PrivateKey::Decrypt(const std::string& in, std::string& out) const {
+  metrics::Timer timer(metrics::Phase::kAsymmetricDecrypt);
+  timer.add_bytes(in.size());
+  if (in.size() != decryptor_.FixedCiphertextLength())
+    throw CryptoPP::InvalidCiphertext("the ciphertext has an invalid size");
+
+  auto offset = out.size();
+  out.resize(offset + decryptor_.MaxPlaintextLength(in.size()));
+  auto result = decryptor_.Decrypt(
+      random_pool(), reinterpret_cast<const byte*>(in.data()), in.size(),
+      reinterpret_cast<byte*>(&out[offset]));
+  if (!result.isValidCoding)
+    throw CryptoPP::InvalidCiphertext("the ciphertext is invalid");
+  out.resize(offset + result.messageLength);
+}
 
-  std::ifstream in_stream(in.path(), std::ios::binary);
-  std::ofstream out_stream(out.path(), std::ios::binary);
+void PrivateKey::Decrypt(const protocol::types::Content& in,
+                         std::string& out) const {
+  std::string encrypted;
+  in.Read([&](const char* data, std::size_t size) {
+    encrypted.append(data, size);
+  });
+  Decrypt(encrypted, out);
+}
 
-  CryptoPP::FileSource{in_stream, true,
-                       new CryptoPP::PK_DecryptorFilter{
-                           rng, d, new CryptoPP::FileSink(out_stream)}};
+std::size_t PrivateKey::ciphertext_size() const {
+  return decryptor_.FixedCiphertextLength();
 }
 
 std::tuple<PublicKey, PrivateKey> Generate() {
+  metrics::Timer timer(metrics::Phase::kGenerate);
   CryptoPP::AutoSeededRandomPool rng;
   CryptoPP::RSA::PrivateKey private_key;
   private_key.Initialize(rng, kModulusbits);
@@ -10,6 +10,8 @@
 #include <cryptopp/rsa.h>
 #endif
 
+#include <atomic>
+#include <string>
 #include <tuple>
 
 #include "../protocol/types.hpp"
@@ -24,37 +26,62 @@ constexpr unsigned int kModulusbits = 1024;
 class PublicKey {
   friend std::tuple<PublicKey, PrivateKey> Generate();
 
+  // The encryptor is prepared once, when the key is loaded, and copies
+  // share it, so the copies a client hands out reuse it.
  public:
   PublicKey(protocol::types::PublicKey public_key);
+  PublicKey(const PublicKey &other);
+  ~PublicKey();
   protocol::types::PublicKey Export();
 
-  // Encrypt a tempfile, and outputs the result to another tempfile
-  // will overwrite the outfile content
-  void Encrypt(const tempfile::TempFile &in,
-               const tempfile::TempFile &out) const;
+  // Encrypts a buffer, and appends the result to another buffer
+  void Encrypt(const std::string &in, std::string &out) const;
+
+  // Encrypts a buffer, and appends the result to a content
+  void Encrypt(const std::string &in, protocol::types::Content &out) const;
+
+  // Copies share their encryptor
+  PublicKey &operator=(const PublicKey &) = delete;
 
  private:
+  struct Prepared {
+    Prepared(const CryptoPP::RSA::PublicKey &key)
+        : public_key(key), encryptor(public_key) {}
+
+    std::atomic<std::size_t> reference_count{1};
+    CryptoPP::RSA::PublicKey public_key;
+    CryptoPP::RSAES_OAEP_SHA_Encryptor encryptor;
+  };
+
   PublicKey(const CryptoPP::RSA::PublicKey public_key)
-      : public_key_(public_key) {}
-  CryptoPP::RSA::PublicKey public_key_;
+      : prepared_(new Prepared(public_key)) {}
+  Prepared *prepared_;
 };
 
 class PrivateKey {
   friend std::tuple<PublicKey, PrivateKey> Generate();
 
+  // The decryptor is prepared once, when the key is loaded,
+  // and reused for every key that is decrypted with it.
  public:
   PrivateKey(const std::string &key);
+  PrivateKey(const PrivateKey &other);
   std::string Export();
 
-  // Decrypt a tempfile, and outputs the result to another tempfile
-  // will overwrite the outfile content
-  void Decrypt(const tempfile::TempFile &in,
-               const tempfile::TempFile &out) const;
+  // Decrypts a buffer, and appends the result to another buffer
+  void Decrypt(const std::string &in, std::string &out) const;
+
+  // Decrypts a content, and appends the result to a buffer
+  void Decrypt(const protocol::types::Content &in, std::string &out) const;
+
+  // The size of the encryption's result, for any input
+  std::size_t ciphertext_size() const;
 
  private:
   PrivateKey(const CryptoPP::RSA::PrivateKey private_key)
-      : private_key_(private_key) {}
+      : private_key_(private_key), decryptor_(private_key_) {}
   CryptoPP::RSA::PrivateKey private_key_;
+  CryptoPP::RSAES_OAEP_SHA_Decryptor decryptor_;
 };
 
 // Generates a new pair of public & private key
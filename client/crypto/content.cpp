@@ -0,0 +1,34 @@
+#include "content.hpp"
+
+namespace messageu {
+namespace crypto {
+
+size_t ContentSink::Put2(const CryptoPP::byte *data, size_t length,
+                         int message_end, bool blocking) {
+  content_.Write(reinterpret_cast<const char *>(data), length);
+  return 0;  // nothing is left unprocessed
+}
+
+size_t WriterSink::Put2(const CryptoPP::byte *data, size_t length,
+                        int message_end, bool blocking) {
+  if (length) write_(reinterpret_cast<const char *>(data), length);
+  return 0;  // nothing is left unprocessed
+}
+
+void PumpContent(const protocol::types::Content &content,
+                 CryptoPP::BufferedTransformation &transformation) {
+  PumpContent(
+      [&](const protocol::types::ContentWriter &write) { content.Read(write); },
+      transformation);
+}
+
+void PumpContent(const protocol::types::ContentReader &read,
+                 CryptoPP::BufferedTransformation &transformation) {
+  read([&](const char *data, std::size_t size) {
+    transformation.Put(reinterpret_cast<const CryptoPP::byte *>(data), size);
+  });
+  transformation.MessageEnd();
+}
+
+}  // namespace crypto
+}  // namespace messageu
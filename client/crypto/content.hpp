@@ -0,0 +1,56 @@
+// Connects the crypto library to the protocol's content,
+// so data can flow between them without intermediate files.
+
+#ifndef CLIENT_CRYPTO_CONTENT_H
+#define CLIENT_CRYPTO_CONTENT_H
+
+#ifdef WIN32
+#include <filters.h>
+#elif __linux__
+#include <cryptopp/filters.h>
+#endif
+
+#include "../protocol/types.hpp"
+
+namespace messageu {
+namespace crypto {
+
+// A sink that appends everything it receives to a content
+class ContentSink : public CryptoPP::Bufferless<CryptoPP::Sink> {
+ public:
+  ContentSink(protocol::types::Content &content) : content_(content) {}
+
+  size_t Put2(const CryptoPP::byte *data, size_t length, int message_end,
+              bool blocking) override;
+
+ private:
+  protocol::types::Content content_;  // shares the content
+};
+
+// A sink that passes everything it receives to a writer,
+// as soon as it receives it.
+class WriterSink : public CryptoPP::Bufferless<CryptoPP::Sink> {
+ public:
+  WriterSink(const protocol::types::ContentWriter &write) : write_(write) {}
+
+  size_t Put2(const CryptoPP::byte *data, size_t length, int message_end,
+              bool blocking) override;
+
+ private:
+  const protocol::types::ContentWriter &write_;
+};
+
+// Passes the whole content through a transformation,
+// and signals the end of the message.
+void PumpContent(const protocol::types::Content &content,
+                 CryptoPP::BufferedTransformation &transformation);
+
+// Passes a content that isn't stored through a transformation,
+// and signals the end of the message.
+void PumpContent(const protocol::types::ContentReader &read,
+                 CryptoPP::BufferedTransformation &transformation);
+
+}  // namespace crypto
+}  // namespace messageu
+
+#endif
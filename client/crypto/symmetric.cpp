@@ -4,19 +4,28 @@
 #include <aes.h>
 #include <files.h>
 #include <filters.h>
+#include <gcm.h>
 #include <modes.h>
 #include <osrng.h>
 #elif __linux__
 #include <cryptopp/aes.h>
 #include <cryptopp/files.h>
 #include <cryptopp/filters.h>
+#include <cryptopp/gcm.h>
 #include <cryptopp/modes.h>
 #include <cryptopp/osrng.h>
 #endif
 
 #include <immintrin.h>  // _rdrand32_step
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
+#include <vector>
+
+#include "../metrics.hpp"
+#include "../parallel.hpp"
+#include "content.hpp"
 
 namespace messageu {
 namespace crypto {
@@ -34,49 +43,343 @@ char* generate_key(char* buff, size_t size) {
 using CryptoPP::byte;
 #endif
 
-Key::Key() : key_{0} { generate_key(reinterpret_cast<char*>(key_), kKeySize); }
+namespace {
+// unsafe but allowed for our purposes
+const byte kIV[CryptoPP::AES::BLOCKSIZE]{0};
+
+constexpr std::size_t kNoncePrefixSize = 8, kNonceSize = 12;
+
+// The layout of a chunked content, as described by its header
+struct Chunking {
+  std::uint32_t chunk_size;
+  std::uint64_t plaintext_size;
+  byte nonce_prefix[kNoncePrefixSize];
 
-Key::Key(const char key[kKeySize]) { memcpy(key_, key, kKeySize); }
+  // Even an empty content has a single (empty) chunk,
+  // so there's always something to authenticate
+  std::uint64_t chunk_count() const {
+    if (!plaintext_size) return 1;
+    return (plaintext_size - 1) / chunk_size + 1;
+  }
 
-Key::Key(const Key& other) { memcpy(key_, other.key_, kKeySize); }
+  std::size_t plaintext_size_of(std::uint64_t index) const {
+    return static_cast<std::size_t>(
+        std::min<std::uint64_t>(chunk_size,
+                                plaintext_size - index * chunk_size));
+  }
 
-void Key::Export(const tempfile::TempFile& out) const {
-  std::ofstream export_file(out.path());
-  export_file.write(reinterpret_cast<const char*>(key_), kKeySize);
+  void nonce_of(std::uint64_t index, byte nonce[kNonceSize]) const {
+    std::copy_n(nonce_prefix, kNoncePrefixSize, nonce);
+    for (std::size_t i = 0; i < kNonceSize - kNoncePrefixSize; ++i)
+      nonce[kNonceSize - 1 - i] = static_cast<byte>(index >> (8 * i));
+  }
+};
+
+// Serializes the header in the protocol's byte order (little-endian)
+void write_header(const Chunking& chunking, byte header[kChunkedHeaderSize]) {
+  for (std::size_t i = 0; i < 4; ++i)
+    header[i] = static_cast<byte>(chunking.chunk_size >> (8 * i));
+  for (std::size_t i = 0; i < 8; ++i)
+    header[4 + i] = static_cast<byte>(chunking.plaintext_size >> (8 * i));
+  std::copy_n(chunking.nonce_prefix, kNoncePrefixSize, header + 12);
 }
 
-void Key::Encrypt(const tempfile::TempFile& in,
-                  const tempfile::TempFile& out) const {
-  std::ifstream in_stream(in.path(), std::ios::binary);
-  Key::Encrypt(in_stream, out);
+// Parses a header, throws CryptoPP::InvalidCiphertext if it's invalid
+Chunking read_header(const byte header[kChunkedHeaderSize]) {
+  Chunking chunking{0, 0, {0}};
+  for (std::size_t i = 0; i < 4; ++i)
+    chunking.chunk_size |= static_cast<std::uint32_t>(header[i]) << (8 * i);
+  for (std::size_t i = 0; i < 8; ++i)
+    chunking.plaintext_size |= static_cast<std::uint64_t>(header[4 + i])
+                               << (8 * i);
+  std::copy_n(header + 12, kNoncePrefixSize, chunking.nonce_prefix);
+
+  if (!chunking.chunk_size || chunking.chunk_size > kMaxChunkSize)
+    throw CryptoPP::InvalidCiphertext("the chunk size is invalid");
+  if (chunking.chunk_count() >> (8 * (kNonceSize - kNoncePrefixSize)))
+    throw CryptoPP::InvalidCiphertext("the content has too many chunks");
+  return chunking;
 }
+}  // namespace
 
-void Key::Encrypt(std::ifstream& istream, const tempfile::TempFile& out) const {
-  byte iv[CryptoPP::AES::BLOCKSIZE]{0};  // unsafe but allowed for our purposes
+Key::Prepared::Prepared(const byte key[kKeySize])
+    : encryption(key, kKeySize),
+      decryption(key, kKeySize),
+      cbc_encryption(encryption, kIV),
+      cbc_decryption(decryption, kIV) {}
 
-  CryptoPP::AES::Encryption aesEncryption(key_, kKeySize);
-  CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption,
-                                                              iv);
+Key::Key() : key_{0} {
+  generate_key(reinterpret_cast<char*>(key_), kKeySize);
+  prepared_ = new Prepared(key_);
+}
 
-  std::ofstream out_stream(out.path(), std::ios::binary);
-  CryptoPP::FileSource{istream, true,
-                       new CryptoPP::StreamTransformationFilter{
-                           cbcEncryption, new CryptoPP::FileSink(out_stream)}};
+Key::Key(const char key[kKeySize]) {
+  memcpy(key_, key, kKeySize);
+  prepared_ = new Prepared(key_);
+}
+
+Key::Key(const Key& other) : prepared_(other.prepared_) {
+  memcpy(key_, other.key_, kKeySize);
+  ++prepared_->reference_count;
+}
+
+Key::~Key() {
+  if (!(--prepared_->reference_count)) delete prepared_;
+}
+
+std::string Key::Export() const {
+  return std::string(reinterpret_cast<const char*>(key_), kKeySize);
 }
 
-void Key::Decrypt(const tempfile::TempFile& in,
+template <typename Function>
+void Key::WithEncryption(Function function) const {
+  std::unique_lock<std::mutex> guard(prepared_->lock, std::try_to_lock);
+  if (guard.owns_lock()) {
+    prepared_->cbc_encryption.Resynchronize(kIV);
+    function(prepared_->cbc_encryption);
+    return;
+  }
+
+  // The modes are busy, copying the key schedule is still cheaper
+  // than running it again
+  CryptoPP::AES::Encryption encryption(prepared_->encryption);
+  CryptoPP::CBC_Mode_ExternalCipher::Encryption cbc_encryption(encryption,
+                                                               kIV);
+  function(cbc_encryption);
+}
+
+template <typename Function>
+void Key::WithDecryption(Function function) const {
+  std::unique_lock<std::mutex> guard(prepared_->lock, std::try_to_lock);
+  if (guard.owns_lock()) {
+    prepared_->cbc_decryption.Resynchronize(kIV);
+    function(prepared_->cbc_decryption);
+    return;
+  }
+
+  CryptoPP::AES::Decryption decryption(prepared_->decryption);
+  CryptoPP::CBC_Mode_ExternalCipher::Decryption cbc_decryption(decryption,
+                                                               kIV);
+  function(cbc_decryption);
+}
+
+void Key::Encrypt(const std::string& in, protocol::types::Content& out) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricEncrypt);
+  timer.add_bytes(in.size());
+  // PKCS padding, every padding byte holds the size of the padding
+  auto size = CiphertextSize(in.size());
+  std::string buffer(in);
+  buffer.resize(size, static_cast<char>(size - in.size()));
+
+  auto* data = reinterpret_cast<byte*>(buffer.data());
+  WithEncryption([&](CryptoPP::StreamTransformation& cbc_encryption) {
+    cbc_encryption.ProcessData(data, data, size);
+  });
+  out.Write(buffer.data(), size);
+}
+
+void Key::Encrypt(std::istream& istream, protocol::types::Content& out) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricEncrypt);
+  auto size = out.size();
+  WithEncryption([&](CryptoPP::StreamTransformation& cbc_encryption) {
+    CryptoPP::FileSource{
+        istream, true,
+        new CryptoPP::StreamTransformationFilter{cbc_encryption,
+                                                 new ContentSink(out)}};
+  });
+  timer.add_bytes(out.size() - size);
+}
+
+void Key::Encrypt(std::istream& istream,
+                  const protocol::types::ContentWriter& write) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricEncrypt);
+  protocol::types::ContentWriter counted_write = [&](const char* data,
+                                                     std::size_t size) {
+    timer.add_bytes(size);
+    write(data, size);
+  };
+  WithEncryption([&](CryptoPP::StreamTransformation& cbc_encryption) {
+    CryptoPP::FileSource{
+        istream, true,
+        new CryptoPP::StreamTransformationFilter{
+            cbc_encryption, new WriterSink(counted_write)}};
+  });
+}
+
+std::uintmax_t Key::CiphertextSize(std::uintmax_t plaintext_size) {
+  // PKCS padding always adds at least one byte, up to a whole block
+  return (plaintext_size / CryptoPP::AES::BLOCKSIZE + 1) *
+         CryptoPP::AES::BLOCKSIZE;
+}
+
+void Key::EncryptChunked(std::istream& istream, std::uintmax_t size,
+                         const protocol::types::ContentWriter& write,
+                         boost::asio::thread_pool& pool,
+                         std::size_t workers) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricEncrypt);
+  timer.add_bytes(size);
+  workers = std::max<std::size_t>(workers, 1);
+  Chunking chunking{kChunkSize, size, {0}};
+  generate_key(reinterpret_cast<char*>(chunking.nonce_prefix),
+               kNoncePrefixSize);
+  byte header[kChunkedHeaderSize];
+  write_header(chunking, header);
+  write(reinterpret_cast<const char*>(header), kChunkedHeaderSize);
+
+  // Each worker encrypts the next chunk, and the chunks are written in order
+  // once they're all done, before the next ones are read.
+  std::vector<std::string> plaintexts(workers), ciphertexts(workers);
+  auto chunk_count = chunking.chunk_count();
+  for (std::uint64_t first = 0; first < chunk_count; first += workers) {
+    auto batch = static_cast<std::size_t>(
+        std::min<std::uint64_t>(workers, chunk_count - first));
+    for (std::size_t i = 0; i < batch; ++i) {
+      auto& plaintext = plaintexts[i];
+      plaintext.resize(chunking.plaintext_size_of(first + i));
+      istream.read(plaintext.data(), plaintext.size());
+      if (static_cast<std::size_t>(istream.gcount()) != plaintext.size())
+        throw std::runtime_error("the file has changed while it was read");
+    }
+
+    parallel::ForEach(pool, workers, batch, [&](std::size_t i) {
+      auto& plaintext = plaintexts[i];
+      auto& ciphertext = ciphertexts[i];
+      ciphertext.resize(plaintext.size() + kChunkTagSize);
+      auto* data = reinterpret_cast<byte*>(ciphertext.data());
+
+      byte nonce[kNonceSize];
+      chunking.nonce_of(first + i, nonce);
+      CryptoPP::GCM<CryptoPP::AES>::Encryption gcm;
+      gcm.SetKeyWithIV(key_, kKeySize, nonce, kNonceSize);
+      gcm.EncryptAndAuthenticate(
+          data, data + plaintext.size(), kChunkTagSize, nonce, kNonceSize,
+          header, kChunkedHeaderSize,
+          reinterpret_cast<const byte*>(plaintext.data()), plaintext.size());
+    });
+    for (std::size_t i = 0; i < batch; ++i)
+      write(ciphertexts[i].data(), ciphertexts[i].size());
+  }
+}
+
+std::uintmax_t Key::ChunkedCiphertextSize(std::uintmax_t plaintext_size) {
+  Chunking chunking{kChunkSize, plaintext_size, {0}};
+  return kChunkedHeaderSize + plaintext_size +
+         chunking.chunk_count() * kChunkTagSize;
+}
+
+void Key::Decrypt(const protocol::types::Content& in, std::string& out) const {
+  Decrypt([&](const protocol::types::ContentWriter& write) { in.Read(write); },
+          out);
+}
+
+void Key::Decrypt(const protocol::types::Content& in,
                   const tempfile::TempFile& out) const {
-  byte iv[CryptoPP::AES::BLOCKSIZE]{0};  // unsafe but allowed for our purposes
+  Decrypt([&](const protocol::types::ContentWriter& write) { in.Read(write); },
+          out);
+}
+
+void Key::Decrypt(const protocol::types::ContentReader& in,
+                  std::string& out) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricDecrypt);
+  auto size = out.size();
+  WithDecryption([&](CryptoPP::StreamTransformation& cbc_decryption) {
+    CryptoPP::StreamTransformationFilter filter{cbc_decryption,
+                                                new CryptoPP::StringSink(out)};
+    PumpContent(in, filter);
+  });
+  timer.add_bytes(out.size() - size);
+}
 
-  CryptoPP::AES::Decryption aesDecryption(key_, kKeySize);
-  CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption,
-                                                              iv);
+void Key::Decrypt(const protocol::types::ContentReader& in,
+                  const tempfile::TempFile& out) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricDecrypt);
+  WithDecryption([&](CryptoPP::StreamTransformation& cbc_decryption) {
+    std::ofstream out_stream(out.path(), std::ios::binary);
+    CryptoPP::StreamTransformationFilter filter{
+        cbc_decryption, new CryptoPP::FileSink(out_stream)};
+    PumpContent(in, filter);
+    timer.add_bytes(out_stream.tellp());
+  });
+}
 
-  std::ifstream in_stream(in.path(), std::ios::binary);
+void Key::DecryptChunked(const protocol::types::ContentReader& in,
+                         const tempfile::TempFile& out,
+                         boost::asio::thread_pool& pool,
+                         std::size_t workers) const {
+  metrics::Timer timer(metrics::Phase::kSymmetricDecrypt);
+  workers = std::max<std::size_t>(workers, 1);
   std::ofstream out_stream(out.path(), std::ios::binary);
-  CryptoPP::FileSource{in_stream, true,
-                       new CryptoPP::StreamTransformationFilter{
-                           cbcDecryption, new CryptoPP::FileSink(out_stream)}};
+
+  byte header[kChunkedHeaderSize];
+  std::size_t header_size = 0;
+  Chunking chunking{0, 0, {0}};
+
+  // The chunks are collected until there's one for each worker,
+  // then they're decrypted together, and written in order.
+  std::vector<std::string> ciphertexts(workers), plaintexts(workers);
+  std::uint64_t first = 0;  // the index of the first collected chunk
+  std::size_t collected = 0;
+  auto decrypt_collected = [&]() {
+    parallel::ForEach(pool, workers, collected, [&](std::size_t i) {
+      auto& ciphertext = ciphertexts[i];
+      auto& plaintext = plaintexts[i];
+      auto size = ciphertext.size() - kChunkTagSize;
+      plaintext.resize(size);
+      auto* data = reinterpret_cast<const byte*>(ciphertext.data());
+
+      byte nonce[kNonceSize];
+      chunking.nonce_of(first + i, nonce);
+      CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+      gcm.SetKeyWithIV(key_, kKeySize, nonce, kNonceSize);
+      if (!gcm.DecryptAndVerify(reinterpret_cast<byte*>(plaintext.data()),
+                                data + size, kChunkTagSize, nonce,
+                                kNonceSize, header, kChunkedHeaderSize, data,
+                                size))
+        throw CryptoPP::InvalidCiphertext("a chunk failed the verification");
+    });
+    for (std::size_t i = 0; i < collected; ++i) {
+      out_stream.write(plaintexts[i].data(), plaintexts[i].size());
+      if (!out_stream)
+        throw std::runtime_error("can not write the decrypted file to " +
+                                 out.path().string());
+      ciphertexts[i].clear();
+    }
+    first += collected;
+    collected = 0;
+  };
+
+  in([&](const char* data, std::size_t size) {
+    while (size) {
+      if (header_size < kChunkedHeaderSize) {
+        auto to_copy = std::min(size, kChunkedHeaderSize - header_size);
+        std::copy_n(data, to_copy, header + header_size);
+        header_size += to_copy;
+        data += to_copy;
+        size -= to_copy;
+        if (header_size == kChunkedHeaderSize) chunking = read_header(header);
+        continue;
+      }
+
+      if (first + collected == chunking.chunk_count())
+        throw CryptoPP::InvalidCiphertext("the content is too long");
+      auto& ciphertext = ciphertexts[collected];
+      auto chunk_size =
+          chunking.plaintext_size_of(first + collected) + kChunkTagSize;
+      auto to_copy = std::min(size, chunk_size - ciphertext.size());
+      ciphertext.append(data, to_copy);
+      data += to_copy;
+      size -= to_copy;
+      if (ciphertext.size() == chunk_size && ++collected == workers)
+        decrypt_collected();
+    }
+  });
+
+  // Whatever was collected, must complete the content
+  if (header_size < kChunkedHeaderSize ||
+      first + collected != chunking.chunk_count())
+    throw CryptoPP::InvalidCiphertext("the content is too short");
+  decrypt_collected();
+  timer.add_bytes(chunking.plaintext_size);
 }
 
 }  // namespace symmetric
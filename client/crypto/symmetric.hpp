@@ -7,13 +7,22 @@
 #ifdef WIN32
 #include <aes.h>
 #include <filters.h>
+#include <gcm.h>
 #include <modes.h>
 #elif __linux__
 #include <cryptopp/aes.h>
 #include <cryptopp/filters.h>
+#include <cryptopp/gcm.h>
 #include <cryptopp/modes.h>
 #endif
 
+#include <atomic>
+#include <boost/asio/thread_pool.hpp>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+
+#include "../protocol/types.hpp"
 #include "../tempfile.hpp"
 
 namespace messageu {
@@ -24,7 +33,34 @@ using CryptoPP::byte;
 
 constexpr auto kKeySize = CryptoPP::AES::DEFAULT_KEYLENGTH;
 
+// A chunked content is made of a header, followed by chunks of this size
+// (the last one may be shorter), each encrypted and authenticated on its
+// own with AES-GCM, so the chunks can be processed in parallel, and each
+// one can be located and verified without the others.
+//
+// header: chunk size (4 bytes), plaintext size (8 bytes),
+//         nonce prefix (8 random bytes)
+// chunk:  ciphertext, tag (16 bytes)
+//
+// The nonce of a chunk is its prefix followed by its index (big-endian),
+// and the header is authenticated along with every chunk, so chunks can't
+// be reordered, dropped, or moved between contents.
+constexpr std::size_t kChunkSize = 1024 * 1024;
+constexpr std::size_t kChunkedHeaderSize = 20;
+constexpr std::size_t kChunkTagSize = 16;
+
+// Larger chunks are rejected, so a content can't make us allocate
+// more than that per worker
+constexpr std::size_t kMaxChunkSize = 16 * 1024 * 1024;
+
 class Key {
+  // The key schedule and the cipher modes are prepared once, when the key
+  // is created, and reused by every message it encrypts or decrypts.
+  // Copies share them, so the copies a client hands out reuse them too.
+  //
+  // The modes hold the state of a single message, so they're only used
+  // by one message at a time; another message, that runs at the same time,
+  // copies the prepared key schedule instead of running it again.
  public:
   // Generates a new key
   Key();
@@ -33,26 +69,95 @@ class Key {
   Key(const char key[kKeySize]);
 
   Key(const Key &other);
+  ~Key();
+
+  // Copies share their prepared ciphers
+  Key &operator=(const Key &) = delete;
+
+  // Exports the raw key
+  std::string Export() const;
+
+  // Encrypts a buffer, and appends the result to a content.
+  // The buffer is encrypted in place of a single block, without filters,
+  // as most buffers are short messages.
+  void Encrypt(const std::string &in, protocol::types::Content &out) const;
+
+  // Encrypt a real file, and appends the result to a content
+  void Encrypt(std::istream &istream, protocol::types::Content &out) const;
+
+  // Encrypts a real file, and passes the result to a writer while
+  // it's being encrypted, without storing it.
+  void Encrypt(std::istream &istream,
+               const protocol::types::ContentWriter &write) const;
 
-  // Exports the key to a tempfile
-  void Export(const tempfile::TempFile &out) const;
+  // The size of the encryption's result for an input of a given size
+  static std::uintmax_t CiphertextSize(std::uintmax_t plaintext_size);
 
-  // Encrypt a tempfile, and outputs the result to another tempfile
+  // Encrypts the first 'size' bytes of a real file into a chunked content,
+  // and passes the result to a writer while it's being encrypted,
+  // 'workers' chunks at a time, on the calling thread and on threads
+  // of the pool (see parallel::ForEach).
+  //
+  // Throws std::runtime_error if the file is shorter than 'size'.
+  void EncryptChunked(std::istream &istream, std::uintmax_t size,
+                      const protocol::types::ContentWriter &write,
+                      boost::asio::thread_pool &pool,
+                      std::size_t workers) const;
+
+  // The size of the chunked encryption's result for an input of a given size
+  static std::uintmax_t ChunkedCiphertextSize(std::uintmax_t plaintext_size);
+
+  // Decrypts a content, and appends the result to a buffer
+  void Decrypt(const protocol::types::Content &in, std::string &out) const;
+
+  // Decrypts a content, and outputs the result to a tempfile
   // will overwrite the outfile's content
-  void Encrypt(const tempfile::TempFile &in,
+  void Decrypt(const protocol::types::Content &in,
                const tempfile::TempFile &out) const;
 
-  // Encrypt a real file, and outputs the result to a tempfile
-  // will overwrite the outfile content
-  void Encrypt(std::ifstream &istream, const tempfile::TempFile &out) const;
+  // Decrypts a content while it's being read, and appends
+  // the result to a buffer
+  void Decrypt(const protocol::types::ContentReader &in,
+               std::string &out) const;
 
-  // Decrypt a tempfile, and outputs the result to another tempfile
-  // will overwrite the outfile's content
-  void Decrypt(const tempfile::TempFile &in,
+  // Decrypts a content while it's being read, and outputs
+  // the result to a tempfile, will overwrite the outfile's content
+  void Decrypt(const protocol::types::ContentReader &in,
                const tempfile::TempFile &out) const;
 
+  // Decrypts a chunked content while it's being read, 'workers' chunks
+  // at a time, on the calling thread and on threads of the pool, and
+  // outputs the result to a tempfile, will overwrite the outfile's content.
+  //
+  // Throws CryptoPP::InvalidCiphertext if the content is malformed,
+  // or any of its chunks fails the verification, and std::runtime_error
+  // if the outfile can't be written.
+  void DecryptChunked(const protocol::types::ContentReader &in,
+                      const tempfile::TempFile &out,
+                      boost::asio::thread_pool &pool,
+                      std::size_t workers) const;
+
  private:
+  struct Prepared {
+    Prepared(const byte key[kKeySize]);
+
+    std::atomic<std::size_t> reference_count{1};
+    std::mutex lock;  // guards the modes
+    CryptoPP::AES::Encryption encryption;
+    CryptoPP::AES::Decryption decryption;
+    CryptoPP::CBC_Mode_ExternalCipher::Encryption cbc_encryption;
+    CryptoPP::CBC_Mode_ExternalCipher::Decryption cbc_decryption;
+  };
+
+  // Internal functions that pass a mode, ready for a new message,
+  // to a function.
+  template <typename Function>
+  void WithEncryption(Function function) const;
+  template <typename Function>
+  void WithDecryption(Function function) const;
+
   byte key_[kKeySize];
+  Prepared *prepared_;
 };
 
 }  // namespace symmetric
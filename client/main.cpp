@@ -1,14 +1,38 @@
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 #include "client.hpp"
 
+// usage: client.out [--batch [file]]
+//
+// The batch is read from the standard input if there's no file, or if
+// the file is '-'.
 int main(int argc, char const* argv[]) {
+  std::istream* batch = nullptr;
+  std::ifstream batch_file;
+  if (argc > 1) {
+    if (std::strcmp(argv[1], "--batch") || argc > 3) {
+      std::cerr << "usage: " << argv[0] << " [--batch [file]]" << std::endl;
+      return 2;
+    }
+    batch = &std::cin;
+    if (argc == 3 && std::strcmp(argv[2], "-")) {
+      batch_file.open(argv[2]);
+      if (!batch_file) {
+        std::cerr << "Can not open the batch file " << argv[2] << std::endl;
+        return 2;
+      }
+      batch = &batch_file;
+    }
+  }
+
   try {
-    messageu::start_client();
+    if (!messageu::start_client(batch)) return 1;
   } catch (const std::exception& e) {
     std::cerr << "Got an unexpected error: " << e.what() << "\nexits safely..."
               << std::endl;
     return 1;
   }
   return 0;
-}
\ No newline at end of file
+}
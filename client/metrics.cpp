@@ -0,0 +1,162 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace messageu {
+namespace metrics {
+
+namespace {
+
+constexpr std::size_t kPhases = static_cast<std::size_t>(Phase::kCount);
+
+// In the order of the phases
+constexpr const char *kPhaseNames[kPhases] = {
+    "resolve",           "connect",           "send",
+    "response",          "tempfile_create",   "tempfile_delete",
+    "generate",          "asymmetric_encrypt", "asymmetric_decrypt",
+    "symmetric_encrypt", "symmetric_decrypt"};
+
+struct Counters {
+  std::atomic<std::uint64_t> count{0};
+  std::atomic<std::uint64_t> total_ns{0};
+  std::atomic<std::uint64_t> bytes{0};
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets{};
+};
+
+// The counters of a single thread, only that thread writes to them,
+// so they're only atomic for the snapshots that read them.
+struct alignas(64) Shard {
+  Counters phases[kPhases];
+};
+
+// Adds to a counter that has a single writer, without a locked instruction
+void add(std::atomic<std::uint64_t> &counter, std::uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+void merge(const Shard &from, Shard &to) {
+  for (std::size_t phase = 0; phase < kPhases; ++phase) {
+    auto &source = from.phases[phase];
+    auto &target = to.phases[phase];
+    add(target.count, source.count.load(std::memory_order_relaxed));
+    add(target.total_ns, source.total_ns.load(std::memory_order_relaxed));
+    add(target.bytes, source.bytes.load(std::memory_order_relaxed));
+    for (std::size_t bucket = 0; bucket < kBuckets; ++bucket)
+      add(target.buckets[bucket],
+          source.buckets[bucket].load(std::memory_order_relaxed));
+  }
+}
+
+// The shards of the running threads, and the sums of the ones that exited
+struct Registry {
+  std::mutex lock;
+  std::vector<Shard *> shards;
+  Shard retired;
+};
+
+// Never destroyed, a thread may still record once the statics are gone
+Registry &registry() {
+  static Registry *instance = new Registry;
+  return *instance;
+}
+
+// Registers the shard of a thread the first time it records,
+// and folds it into the retired counters once the thread exits.
+class ThreadShard {
+ public:
+  ThreadShard() : shard_(new Shard()) {
+    auto &instance = registry();
+    std::lock_guard<std::mutex> guard(instance.lock);
+    instance.shards.push_back(shard_);
+  }
+
+  ~ThreadShard() {
+    auto &instance = registry();
+    std::lock_guard<std::mutex> guard(instance.lock);
+    merge(*shard_, instance.retired);
+    instance.shards.erase(
+        std::find(instance.shards.begin(), instance.shards.end(), shard_));
+    delete shard_;
+  }
+
+  Shard &shard() { return *shard_; }
+
+  ThreadShard(const ThreadShard &) = delete;
+
+ private:
+  Shard *shard_;
+};
+
+std::size_t bucket_of(Clock::duration latency) {
+  auto microseconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  std::size_t bucket = 0;
+  for (; microseconds > 0 && bucket < kBuckets - 1; microseconds >>= 1)
+    ++bucket;
+  return bucket;
+}
+
+}  // namespace
+
+void Record(Phase phase, Clock::duration latency, std::uintmax_t bytes) {
+  thread_local ThreadShard thread_shard;
+  auto &counters =
+      thread_shard.shard().phases[static_cast<std::size_t>(phase)];
+  add(counters.count, 1);
+  add(counters.total_ns,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+  add(counters.bytes, bytes);
+  add(counters.buckets[bucket_of(latency)], 1);
+}
+
+std::string Snapshot() {
+  Shard total;
+  {
+    auto &instance = registry();
+    std::lock_guard<std::mutex> guard(instance.lock);
+    merge(instance.retired, total);
+    for (auto shard : instance.shards) merge(*shard, total);
+  }
+
+  std::ostringstream json;
+  json << "{\"bucket_bounds_us\": [";
+  for (std::size_t bucket = 0; bucket < kBuckets - 1; ++bucket)
+    json << (bucket ? ", " : "") << (std::uint64_t{1} << bucket);
+  json << "], \"phases\": {";
+  for (std::size_t phase = 0; phase < kPhases; ++phase) {
+    auto &counters = total.phases[phase];
+    json << (phase ? ", " : "") << '"' << kPhaseNames[phase]
+         << "\": {\"count\": " << counters.count
+         << ", \"total_us\": " << counters.total_ns / 1000
+         << ", \"bytes\": " << counters.bytes << ", \"histogram\": [";
+    for (std::size_t bucket = 0; bucket < kBuckets; ++bucket)
+      json << (bucket ? ", " : "") << counters.buckets[bucket];
+    json << "]}";
+  }
+  json << "}}";
+  return json.str();
+}
+
+void WriteSnapshot(const std::filesystem::path &file) {
+  auto temporary = file;
+  temporary += ".tmp";
+  {
+    std::ofstream output(temporary, std::ofstream::trunc);
+    output << Snapshot() << std::endl;
+    if (!output)
+      throw std::runtime_error("can not write the metrics to " +
+                               temporary.string());
+  }
+  std::filesystem::rename(temporary, file);
+}
+
+}  // namespace metrics
+}  // namespace messageu
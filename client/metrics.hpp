@@ -0,0 +1,79 @@
+// Measures where the time of a request goes
+//
+// The client records the latency of each phase of its hot paths, along
+// with the amount of bytes the phase processed, into counters that belong
+// to the recording thread, so recording never takes a lock, or shares a
+// cache line with another thread.
+//
+// A snapshot sums the counters of all the threads into a JSON document.
+#ifndef CLIENT_METRICS_H
+#define CLIENT_METRICS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace messageu {
+namespace metrics {
+
+enum class Phase : std::size_t {
+  kResolve,            // resolving a target by its username or id
+  kConnect,            // opening a new connection to the server
+  kSend,               // writing a request to the server
+  kResponse,           // waiting for the header of a response, and for its
+                       // first byte over a reused connection
+  kTempfileCreate,     // creating a tempfile
+  kTempfileDelete,     // deleting a tempfile
+  kGenerate,           // generating a pair of asymmetric keys
+  kAsymmetricEncrypt,  // wrapping a symmetric key
+  kAsymmetricDecrypt,  // unwrapping a symmetric key
+  kSymmetricEncrypt,   // encrypting a message, or a file
+  kSymmetricDecrypt,   // decrypting a message, or a file
+  kCount,              // the amount of phases, not a phase
+};
+
+// The latencies of each phase are counted in buckets, bucket 0 counts
+// latencies under a microsecond, bucket i counts the ones under 2^i
+// microseconds, and the last bucket counts everything above them.
+constexpr std::size_t kBuckets = 32;
+
+using Clock = std::chrono::steady_clock;
+
+// Records a single run of a phase, and the amount of bytes it processed
+void Record(Phase phase, Clock::duration latency, std::uintmax_t bytes = 0);
+
+// Records a run of a phase from the moment it's created, until it's
+// destroyed, so a phase that throws is recorded as well.
+class Timer {
+ public:
+  Timer(Phase phase) : phase_(phase), start_(Clock::now()) {}
+  ~Timer() { Record(phase_, Clock::now() - start_, bytes_); }
+
+  void add_bytes(std::uintmax_t bytes) { bytes_ += bytes; }
+
+  Timer(const Timer &) = delete;
+
+ private:
+  Phase phase_;
+  Clock::time_point start_;
+  std::uintmax_t bytes_ = 0;
+};
+
+// Returns the counters of all the threads, summed into a JSON document:
+//  {"bucket_bounds_us": [1, 2, 4, ...],
+//   "phases": {"connect": {"count": 3, "total_us": 412, "bytes": 0,
+//                          "histogram": [0, 0, 1, ...]}, ...}}
+// where "histogram" holds the count of each bucket, in the order
+// of "bucket_bounds_us", and one more for the last bucket.
+std::string Snapshot();
+
+// Writes the snapshot to a file, the file is replaced at once,
+// so whoever reads it never sees half a snapshot.
+void WriteSnapshot(const std::filesystem::path &file);
+
+}  // namespace metrics
+}  // namespace messageu
+
+#endif
@@ -0,0 +1,81 @@
+#include "parallel.hpp"
+
+#include <boost/asio/post.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+namespace messageu {
+namespace parallel {
+namespace {
+// The state of a single ForEach. A thread of the pool may only get to it
+// after all the indexes were done, and ForEach returned, so the last
+// thread that leaves it deletes it.
+struct Shared {
+  Shared(std::size_t count,
+         const std::function<void(std::size_t index)> &function,
+         std::size_t references)
+      : count(count), function(function), references(references) {}
+
+  const std::size_t count;
+  // Only called while there are indexes left, so ForEach didn't return
+  const std::function<void(std::size_t index)> &function;
+  std::atomic<std::size_t> next{0};
+  std::atomic<std::size_t> references;
+
+  std::mutex lock;  // guards done and error
+  std::condition_variable all_done;
+  std::size_t done = 0;
+  std::exception_ptr error;
+};
+
+// Takes the next index until none is left
+void work(Shared &shared) {
+  for (auto i = shared.next++; i < shared.count; i = shared.next++) {
+    std::exception_ptr error;
+    try {
+      shared.function(i);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> guard(shared.lock);
+    if (error && !shared.error) shared.error = error;
+    if (++shared.done == shared.count) shared.all_done.notify_all();
+  }
+}
+
+void release(Shared *shared) {
+  if (!--shared->references) delete shared;
+}
+}  // namespace
+
+void ForEach(boost::asio::thread_pool &pool, std::size_t workers,
+             std::size_t count,
+             const std::function<void(std::size_t index)> &function) {
+  if (!count) return;
+  auto helpers = std::min(std::max<std::size_t>(workers, 1), count) - 1;
+  auto *shared = new Shared(count, function, helpers + 1);
+  for (std::size_t i = 0; i < helpers; ++i) {
+    boost::asio::post(pool, [shared]() {
+      work(*shared);
+      release(shared);
+    });
+  }
+
+  work(*shared);
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> guard(shared->lock);
+    shared->all_done.wait(guard,
+                          [shared]() { return shared->done == shared->count; });
+    error = shared->error;
+  }
+  release(shared);
+  if (error) std::rethrow_exception(error);
+}
+
+}  // namespace parallel
+}  // namespace messageu
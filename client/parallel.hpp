@@ -0,0 +1,29 @@
+// Splits work between the calling thread and a pool of threads
+// that lives as long as its owner.
+
+#ifndef CLIENT_PARALLEL_H
+#define CLIENT_PARALLEL_H
+
+#include <boost/asio/thread_pool.hpp>
+#include <cstddef>
+#include <functional>
+
+namespace messageu {
+namespace parallel {
+
+// Runs a function for each index up to 'count', on up to 'workers' threads
+// at once: the calling thread, and threads of the pool. Each one takes the
+// next index until none is left. Returns once all the indexes are done,
+// and rethrows the first exception the function threw.
+//
+// The calling thread takes part, so the work is done even while the pool
+// is busy with the work of others. The function must not wait for other
+// work of the same pool.
+void ForEach(boost::asio::thread_pool &pool, std::size_t workers,
+             std::size_t count,
+             const std::function<void(std::size_t index)> &function);
+
+}  // namespace parallel
+}  // namespace messageu
+
+#endif
@@ -0,0 +1,56 @@
+#include "reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "exceptions.hpp"
+
+namespace messageu {
+namespace protocol {
+namespace reader {
+
+BufferedReader::BufferedReader(boost::asio::ip::tcp::socket &&socket,
+                               std::uintmax_t limit)
+    : socket_(std::move(socket)), left_(limit), buffer_(kBufferSize) {}
+
+const unsigned char *BufferedReader::Take(std::size_t size) {
+  if (buffered() < size) {
+    // Move what's left to the beginning, to make room for a large read
+    std::memmove(buffer_.data(), buffer_.data() + begin_, buffered());
+    end_ = buffered();
+    begin_ = 0;
+
+    while (end_ < size) {
+      if (!left_) throw exceptions::ContentMismatch();
+      auto to_read = std::min<std::uintmax_t>(buffer_.size() - end_, left_);
+      auto read_size = socket_.read_some(
+          boost::asio::buffer(buffer_.data() + end_, to_read));
+      end_ += read_size;
+      left_ -= read_size;
+    }
+  }
+
+  auto data = buffer_.data() + begin_;
+  begin_ += size;
+  return data;
+}
+
+std::size_t BufferedReader::ReadSome(char *data, std::size_t size) {
+  if (buffered()) {  // pass what's already buffered first
+    size = std::min(size, buffered());
+    std::memcpy(data, buffer_.data() + begin_, size);
+    begin_ += size;
+    return size;
+  }
+
+  // Nothing is buffered, so read straight into the caller's memory
+  if (!left_) throw exceptions::ContentMismatch();
+  auto read_size = socket_.read_some(
+      boost::asio::buffer(data, std::min<std::uintmax_t>(size, left_)));
+  left_ -= read_size;
+  return read_size;
+}
+
+}  // namespace reader
+}  // namespace protocol
+}  // namespace messageu
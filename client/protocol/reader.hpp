@@ -0,0 +1,55 @@
+#ifndef CLIENT_PROTOCOL_READER_H
+#define CLIENT_PROTOCOL_READER_H
+
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace messageu {
+namespace protocol {
+namespace reader {
+
+// The size of the buffer responses are read into
+constexpr std::size_t kBufferSize = 64 * 1024;
+
+// Reads a response from a socket through a buffer, so many small
+// records are parsed out of a few large reads, instead of a read each.
+//
+// The reader never reads more than the limit it was given, so whatever
+// follows the response (on a kept-alive connection) stays in the socket.
+class BufferedReader {
+ public:
+  // Reads at most 'limit' bytes from the socket.
+  BufferedReader(boost::asio::ip::tcp::socket &&socket, std::uintmax_t limit);
+
+  // Reads exactly 'size' bytes, up to kBufferSize, and returns them
+  // in place, they're only valid until the next call to the reader.
+  //
+  // throws ContentMismatch if the limit is reached before that.
+  const unsigned char *Take(std::size_t size);
+
+  // Reads at least one byte, and at most 'size' bytes into data,
+  // returns the amount of bytes that were read.
+  //
+  // throws ContentMismatch if the limit has already been reached.
+  std::size_t ReadSome(char *data, std::size_t size);
+
+  // Gives back the ownership over the socket,
+  // should only be used once the whole response has been read.
+  boost::asio::ip::tcp::socket ReleaseSocket() { return std::move(socket_); }
+
+ private:
+  // The amount of bytes that are buffered, and weren't read yet
+  std::size_t buffered() const { return end_ - begin_; }
+
+  boost::asio::ip::tcp::socket socket_;
+  std::uintmax_t left_;  // the amount of bytes that are left in the socket
+  std::vector<unsigned char> buffer_;
+  std::size_t begin_ = 0, end_ = 0;
+};
+
+}  // namespace reader
+}  // namespace protocol
+}  // namespace messageu
+
+#endif
@@ -1,7 +1,15 @@
 #include "request.hpp"
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <cmath>
-#include <fstream>
+#include <filesystem>
+#include <vector>
 
 #include "exceptions.hpp"
 
@@ -9,15 +17,74 @@ namespace messageu {
 namespace protocol {
 namespace request {
 
+namespace {
+#ifdef __linux__
+// Sends 'size' bytes of a file straight from the kernel into the socket,
+// so the file's content never has to be copied through userspace.
+void send_file(boost::asio::ip::tcp::socket &socket,
+               const std::filesystem::path &path, std::uintmax_t size) {
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file == -1)
+    throw boost::system::system_error(errno, boost::system::system_category(),
+                                      "open");
+
+  try {
+    off_t offset = 0;
+    while (static_cast<std::uintmax_t>(offset) < size) {
+      auto sent =
+          ::sendfile(socket.native_handle(), file, &offset, size - offset);
+      if (sent > 0 || (sent == -1 && errno == EINTR)) continue;
+      if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        socket.wait(boost::asio::ip::tcp::socket::wait_write);
+        continue;
+      }
+      // the file ended before the whole content was sent
+      if (!sent) throw exceptions::ContentMismatch();
+      throw boost::system::system_error(
+          errno, boost::system::system_category(), "sendfile");
+    }
+  } catch (...) {
+    ::close(file);
+    throw;
+  }
+  ::close(file);
+}
+#endif
+
+// Sends a content that spilled to its dump file
+void send_stored(boost::asio::ip::tcp::socket &socket,
+                 const types::Content &content) {
+#ifdef __linux__
+  send_file(socket, content.file().path(), content.size());
+#else
+  content.Read([&](const char *data, std::size_t size) {
+    boost::asio::write(socket, boost::asio::buffer(data, size));
+  });
+#endif
+}
+}  // namespace
+
 Header::Header(const types::ClientID &sender_id, const types::Code &code,
                const types::PayloadSize &payload_size)
     : sender_id_(sender_id), code_(code), payload_size_(payload_size) {}
 
-void Header::send(boost::asio::ip::tcp::socket &socket) const {
-  boost::asio::write(socket, boost::asio::buffer(sender_id_));
-  boost::asio::write(socket, boost::asio::buffer(kClientVersion.Serialize()));
-  boost::asio::write(socket, boost::asio::buffer(code_.Serialize()));
-  boost::asio::write(socket, boost::asio::buffer(payload_size_.Serialize()));
+void Header::send(boost::asio::ip::tcp::socket &socket,
+                  bool keep_alive) const {
+  boost::asio::write(socket, boost::asio::buffer(Serialize(keep_alive)));
+}
+
+std::array<unsigned char, Header::kSize> Header::Serialize(
+    bool keep_alive) const {
+  auto version = (keep_alive ? kKeepAliveVersion : kClientVersion).Serialize();
+  auto code = code_.Serialize();
+  auto payload_size = payload_size_.Serialize();
+
+  std::array<unsigned char, kSize> data;
+  auto position = std::copy(sender_id_.begin(), sender_id_.end(), data.begin());
+  position = std::copy(version.begin(), version.end(), position);
+  position = std::copy(code.begin(), code.end(), position);
+  std::copy(payload_size.begin(), payload_size.end(), position);
+  return data;
 }
 
 types::ClientID Register::dump_id_;
@@ -29,18 +96,36 @@ Register::Register(const types::Username &username,
       username_(username),
       public_key_(public_key) {}
 
-void Register::send(boost::asio::ip::tcp::socket &socket) const {
-  Header::send(socket);
-  boost::asio::write(socket, boost::asio::buffer(username_));
-  boost::asio::write(socket, boost::asio::buffer(public_key_));
+void Register::send(boost::asio::ip::tcp::socket &socket,
+                    bool keep_alive) const {
+  auto header = Serialize(keep_alive);
+  boost::asio::write(socket, std::array<boost::asio::const_buffer, 3>{
+                                 boost::asio::buffer(header),
+                                 boost::asio::buffer(username_),
+                                 boost::asio::buffer(public_key_)});
 }
 
 ClientList::ClientList(const types::ClientID &sender_id)
     : Header(sender_id, kClientListCode,
              static_cast<types::PayloadSize::DataType>(0)) {}
 
-void ClientList::send(boost::asio::ip::tcp::socket &socket) const {
-  Header::send(socket);
+void ClientList::send(boost::asio::ip::tcp::socket &socket,
+                      bool keep_alive) const {
+  Header::send(socket, keep_alive);
+}
+
+ClientListSince::ClientListSince(const types::ClientID &sender_id,
+                                 const types::Timestamp &since)
+    : Header(sender_id, kClientListSinceCode, types::kTimestampSize),
+      since_(since) {}
+
+void ClientListSince::send(boost::asio::ip::tcp::socket &socket,
+                           bool keep_alive) const {
+  auto header = Serialize(keep_alive);
+  auto since = since_.Serialize();
+  boost::asio::write(socket, std::array<boost::asio::const_buffer, 2>{
+                                 boost::asio::buffer(header),
+                                 boost::asio::buffer(since)});
 }
 
 GetPublicKey::GetPublicKey(const types::ClientID &sender_id,
@@ -48,9 +133,12 @@ GetPublicKey::GetPublicKey(const types::ClientID &sender_id,
     : Header(sender_id, kPublicKeyCode, types::kClientIDSize),
       target_id_(target_id) {}
 
-void GetPublicKey::send(boost::asio::ip::tcp::socket &socket) const {
-  Header::send(socket);
-  boost::asio::write(socket, boost::asio::buffer(target_id_));
+void GetPublicKey::send(boost::asio::ip::tcp::socket &socket,
+                        bool keep_alive) const {
+  auto header = Serialize(keep_alive);
+  boost::asio::write(socket, std::array<boost::asio::const_buffer, 2>{
+                                 boost::asio::buffer(header),
+                                 boost::asio::buffer(target_id_)});
 }
 
 SendMessage::SendMessage(const types::ClientID &sender_id,
@@ -58,42 +146,215 @@ SendMessage::SendMessage(const types::ClientID &sender_id,
                          const types::MessageType &type, types::Content content)
     : Header(sender_id, kSendMessagesCode,
              types::kClientIDSize + types::kMessageTypeSize +
-                 types::kContentSizeSize + content->size()),
+                 types::kContentSizeSize + content.size()),
       target_id_(target_id),
       type_(type),
+      content_size_(content.size()),
       content_(content) {}
 
-void SendMessage::send(boost::asio::ip::tcp::socket &socket) const {
+SendMessage::SendMessage(const types::ClientID &sender_id,
+                         const types::ClientID &target_id,
+                         const types::MessageType &type,
+                         std::uintmax_t content_size,
+                         types::ContentProducer produce)
+    : Header(sender_id, kSendMessagesCode,
+             types::kClientIDSize + types::kMessageTypeSize +
+                 types::kContentSizeSize + content_size),
+      target_id_(target_id),
+      type_(type),
+      content_size_(content_size),
+      content_("empty_file"),
+      produce_(produce) {}
+
+void SendMessage::send(boost::asio::ip::tcp::socket &socket,
+                       bool keep_alive) const {
   static const std::uintmax_t max_content_size =
       std::pow(2, types::kContentSizeSize * 8) - 1;
   // we don't care about an inconsistency with the payload size,
   // that's the job of the server... we only need to avoid overflow.
-  if (content_->size() > max_content_size)
-    throw exceptions::ContentSizeLimit(max_content_size, content_->size());
-  Header::send(socket);
-  boost::asio::write(socket, boost::asio::buffer(target_id_));
-  boost::asio::write(socket, boost::asio::buffer(type_.Serialize()));
-  boost::asio::write(
-      socket,
-      boost::asio::buffer(types::ContentSize(content_->size()).Serialize()));
-
-  std::ifstream content_file(content_->path(), std::ofstream::binary);
-  while (content_file) {
-    char data[types::kBlockSize]{0};
-    content_file.read(data, types::kBlockSize);
-    if (content_file.gcount())  // write as much as you actually read
-      boost::asio::write(socket,
-                         boost::asio::buffer(data, content_file.gcount()));
+  if (content_size_ > max_content_size)
+    throw exceptions::ContentSizeLimit(max_content_size, content_size_);
+  auto header = Serialize(keep_alive);
+  auto type = type_.Serialize();
+  auto content_size = types::ContentSize(content_size_).Serialize();
+  Fields fields{boost::asio::buffer(header), boost::asio::buffer(target_id_),
+                boost::asio::buffer(type), boost::asio::buffer(content_size)};
+
+  if (produce_) return SendProduced(socket, fields);
+  if (content_.in_memory()) {  // small enough to go out along with the fields
+    boost::asio::write(socket, std::array<boost::asio::const_buffer, 5>{
+                                   fields[0], fields[1], fields[2], fields[3],
+                                   boost::asio::buffer(content_.buffer())});
+    return;
   }
+
+  boost::asio::write(socket, fields);
+  send_stored(socket, content_);
 }
 
-RetrievePendingMessages::RetrievePendingMessages(
-    const types::ClientID &sender_id)
-    : Header(sender_id, kRetrievePendingMessageCode,
-             static_cast<types::PayloadSize::DataType>(0)) {}
+void SendMessage::SendProduced(boost::asio::ip::tcp::socket &socket,
+                               const Fields &fields) const {
+  // The producer may pass many small chunks, so we gather
+  // them to avoid a system call for each one of them.
+  // The fields go out along with the first block.
+  auto block_size = types::block_size();
+  std::vector<char> block;
+  block.reserve(block_size);
+  for (const auto &field : fields) {
+    auto data = static_cast<const char *>(field.data());
+    block.insert(block.end(), data, data + field.size());
+  }
+  std::uintmax_t produced = 0;
+
+  produce_([&](const char *data, std::size_t size) {
+    produced += size;
+    // the header is already sent, we can't send more than we promised
+    if (produced > content_size_) throw exceptions::ContentMismatch();
+
+    while (size) {
+      auto chunk = std::min(size, block_size - block.size());
+      block.insert(block.end(), data, data + chunk);
+      data += chunk;
+      size -= chunk;
+      if (block.size() == block_size) {
+        boost::asio::write(socket, boost::asio::buffer(block));
+        block.clear();
+      }
+    }
+  });
+
+  if (produced != content_size_) throw exceptions::ContentMismatch();
+  if (!block.empty()) boost::asio::write(socket, boost::asio::buffer(block));
+}
+
+SendMessageBatch::SendMessageBatch(const types::ClientID &sender_id,
+                                   std::vector<Record> records)
+    : Header(sender_id, kSendMessageBatchCode,
+             static_cast<types::PayloadSize::DataType>(PayloadSize(records))),
+      records_(std::move(records)),
+      payload_size_(PayloadSize(records_)) {}
+
+std::uintmax_t SendMessageBatch::PayloadSize(
+    const std::vector<Record> &records) {
+  std::uintmax_t size = 0;
+  for (const auto &record : records)
+    size += types::kClientIDSize + types::kMessageTypeSize +
+            types::kContentSizeSize + record.content.size();
+  return size;
+}
+
+void SendMessageBatch::send(boost::asio::ip::tcp::socket &socket,
+                            bool keep_alive) const {
+  static const std::uintmax_t max_payload_size =
+      std::pow(2, types::kPayloadSizeSize * 8) - 1;
+  if (payload_size_ > max_payload_size)
+    throw exceptions::ContentSizeLimit(max_payload_size, payload_size_);
+
+  constexpr auto fields_size =
+      types::kClientIDSize + types::kMessageTypeSize + types::kContentSizeSize;
+  auto header = Serialize(keep_alive);
+  std::vector<std::array<unsigned char, fields_size>> fields(records_.size());
+
+  // The records are gathered into a single write, up to
+  // a content that spilled to the disk, which is sent on its own.
+  std::vector<boost::asio::const_buffer> buffers{boost::asio::buffer(header)};
+  for (std::size_t i = 0; i < records_.size(); ++i) {
+    const auto &record = records_[i];
+    auto type = record.type.Serialize();
+    auto content_size =
+        types::ContentSize(
+            static_cast<types::ContentSize::DataType>(record.content.size()))
+            .Serialize();
+    auto position = std::copy(record.target_id.begin(), record.target_id.end(),
+                              fields[i].begin());
+    position = std::copy(type.begin(), type.end(), position);
+    std::copy(content_size.begin(), content_size.end(), position);
+    buffers.push_back(boost::asio::buffer(fields[i]));
+
+    if (record.content.in_memory()) {
+      buffers.push_back(boost::asio::buffer(record.content.buffer()));
+      continue;
+    }
+    boost::asio::write(socket, buffers);
+    buffers.clear();
+    send_stored(socket, record.content);
+  }
+  if (!buffers.empty()) boost::asio::write(socket, buffers);
+}
+
+SendMessagePart::SendMessagePart(const types::ClientID &sender_id,
+                                 const types::ClientID &target_id,
+                                 const types::MessageType &type,
+                                 const types::ContentSize &content_size,
+                                 const types::MessageID &transfer_id,
+                                 const types::ContentSize &offset,
+                                 const char *data, std::size_t size)
+    : Header(sender_id, kSendMessagePartCode,
+             types::kClientIDSize + types::kMessageTypeSize +
+                 types::kContentSizeSize + types::kMessageIDSize +
+                 types::kContentSizeSize + size),
+      target_id_(target_id),
+      type_(type),
+      content_size_(content_size),
+      transfer_id_(transfer_id),
+      offset_(offset),
+      data_(data),
+      size_(size) {}
+
+void SendMessagePart::send(boost::asio::ip::tcp::socket &socket,
+                           bool keep_alive) const {
+  auto header = Serialize(keep_alive);
+  auto type = type_.Serialize();
+  auto content_size = content_size_.Serialize();
+  auto transfer_id = transfer_id_.Serialize();
+  auto offset = offset_.Serialize();
+  boost::asio::write(socket, std::array<boost::asio::const_buffer, 7>{
+                                 boost::asio::buffer(header),
+                                 boost::asio::buffer(target_id_),
+                                 boost::asio::buffer(type),
+                                 boost::asio::buffer(content_size),
+                                 boost::asio::buffer(transfer_id),
+                                 boost::asio::buffer(offset),
+                                 boost::asio::buffer(data_, size_)});
+}
+
+RetrievePendingMessagesFrom::RetrievePendingMessagesFrom(
+    const types::ClientID &sender_id, const types::MessageID &from,
+    const types::ContentSize &offset)
+    : Header(sender_id, kRetrievePendingMessagesFromCode,
+             types::kMessageIDSize + types::kContentSizeSize),
+      from_(from),
+      offset_(offset) {}
+
+void RetrievePendingMessagesFrom::send(boost::asio::ip::tcp::socket &socket,
+                                       bool keep_alive) const {
+  auto header = Serialize(keep_alive);
+  auto from = from_.Serialize();
+  auto offset = offset_.Serialize();
+  boost::asio::write(socket, std::array<boost::asio::const_buffer, 3>{
+                                 boost::asio::buffer(header),
+                                 boost::asio::buffer(from),
+                                 boost::asio::buffer(offset)});
+}
+
+SubscribePendingMessages::SubscribePendingMessages(
+    const types::ClientID &sender_id, const types::MessageID &from)
+    : Header(sender_id, kSubscribePendingMessagesCode, types::kMessageIDSize),
+      from_(from) {}
+
+void SubscribePendingMessages::send(boost::asio::ip::tcp::socket &socket,
+                                    bool keep_alive) const {
+  auto header = Serialize(keep_alive);
+  auto from = from_.Serialize();
+  boost::asio::write(socket, std::array<boost::asio::const_buffer, 2>{
+                                 boost::asio::buffer(header),
+                                 boost::asio::buffer(from)});
+}
 
-void RetrievePendingMessages::send(boost::asio::ip::tcp::socket &socket) const {
-  Header::send(socket);
+void SubscriptionAcknowledgment::send(
+    boost::asio::ip::tcp::socket &socket) const {
+  auto next = next_.Serialize();
+  boost::asio::write(socket, boost::asio::buffer(next));
 }
 
 }  // namespace request
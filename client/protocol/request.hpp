@@ -1,7 +1,10 @@
 #ifndef CLIENT_PROTOCOL_REQUEST_H
 #define CLIENT_PROTOCOL_REQUEST_H
 
+#include <array>
 #include <boost/asio.hpp>
+#include <cstddef>
+#include <vector>
 
 #include "types.hpp"
 
@@ -11,20 +14,46 @@ namespace request {
 
 constexpr types::Code::DataType kRegisterCode = 1100, kClientListCode = 1101,
                                 kPublicKeyCode = 1102, kSendMessagesCode = 1103,
-                                kRetrievePendingMessageCode = 1104;
+                                kRetrievePendingMessageCode = 1104,
+                                kClientListSinceCode = 1105,
+                                kSendMessagePartCode = 1106,
+                                kRetrievePendingMessagesFromCode = 1107,
+                                kSendMessageBatchCode = 1108,
+                                kSubscribePendingMessagesCode = 1109;
 
 const types::Version kClientVersion = 2;
 
+// Requests that are sent with this version ask the server to keep
+// the connection open once it responds, so it can be reused.
+const types::Version kKeepAliveVersion = 3;
+
 class Header {
  public:
   // Serializes the request into an open socket.
-  virtual void send(boost::asio::ip::tcp::socket &socket) const;
+  //
+  // When keep_alive is set, the server will wait for another
+  // request on the same connection, instead of closing it.
+  //
+  // Each request is gathered into a single write, so its
+  // fields don't go out as separate small segments.
+  virtual void send(boost::asio::ip::tcp::socket &socket,
+                    bool keep_alive = false) const;
+
+  // The size of the whole request, header included
+  std::uintmax_t size() const { return kSize + payload_size_.value(); }
 
  protected:
+  static constexpr std::size_t kSize = types::kClientIDSize +
+                                       types::kVersionSize + types::kCodeSize +
+                                       types::kPayloadSizeSize;
+
   Header(const types::ClientID &sender_id, const types::Code &code,
          const types::PayloadSize &payload_size);
   virtual ~Header() = default;
 
+  // Serializes the header into raw data.
+  std::array<unsigned char, kSize> Serialize(bool keep_alive) const;
+
  private:
   types::ClientID sender_id_;
   types::Code code_;
@@ -34,7 +63,8 @@ class Header {
 class Register : public Header {
  public:
   Register(const types::Username &username, const types::PublicKey &public_key);
-  void send(boost::asio::ip::tcp::socket &socket) const override;
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
 
  private:
   static types::ClientID dump_id_;
@@ -45,14 +75,29 @@ class Register : public Header {
 class ClientList : public Header {
  public:
   ClientList(const types::ClientID &sender_id);
-  void send(boost::asio::ip::tcp::socket &socket) const override;
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
+};
+
+// Asks only for the clients that changed since a given version
+// of the client list, zero asks for all of them.
+class ClientListSince : public Header {
+ public:
+  ClientListSince(const types::ClientID &sender_id,
+                  const types::Timestamp &since);
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
+
+ private:
+  types::Timestamp since_;
 };
 
 class GetPublicKey : public Header {
  public:
   GetPublicKey(const types::ClientID &sender_id,
                const types::ClientID &target_id);
-  void send(boost::asio::ip::tcp::socket &socket) const override;
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
 
  private:
   types::ClientID target_id_;
@@ -63,18 +108,129 @@ class SendMessage : public Header {
   SendMessage(const types::ClientID &sender_id,
               const types::ClientID &target_id, const types::MessageType &type,
               types::Content content);
-  void send(boost::asio::ip::tcp::socket &socket) const override;
+
+  // Sends a content that is produced while it's being sent, so it
+  // never has to be stored. The producer must pass exactly
+  // 'content_size' bytes, and it's called again if the request is resent.
+  SendMessage(const types::ClientID &sender_id,
+              const types::ClientID &target_id, const types::MessageType &type,
+              std::uintmax_t content_size, types::ContentProducer produce);
+
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
+
+ private:
+  // The serialized fields that precede the content
+  using Fields = std::array<boost::asio::const_buffer, 4>;
+
+  // Internal function that writes the fields followed by
+  // the produced content, gathered into large blocks.
+  void SendProduced(boost::asio::ip::tcp::socket &socket,
+                    const Fields &fields) const;
+
+  types::ClientID target_id_;
+  types::MessageType type_;
+  std::uintmax_t content_size_;
+  types::Content content_;          // empty when the content is produced
+  types::ContentProducer produce_;  // empty when the content is stored
+};
+
+// Sends several messages in a single request, each to its own target.
+// The server adds all of them, or none of them.
+class SendMessageBatch : public Header {
+ public:
+  struct Record {
+    types::ClientID target_id;
+    types::MessageType type;
+    types::Content content;
+  };
+
+  SendMessageBatch(const types::ClientID &sender_id,
+                   std::vector<Record> records);
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
+
+ private:
+  // Internal function that sums the size of the records
+  static std::uintmax_t PayloadSize(const std::vector<Record> &records);
+
+  std::vector<Record> records_;
+  std::uintmax_t payload_size_;
+};
+
+// Sends a part of a content, that starts at 'offset', the server turns
+// the transfer into a message once all of its 'content_size' bytes arrived.
+// A transfer id of zero starts a new transfer.
+//
+// The server only stores a part that starts where the content it has
+// ends, so a part can be sent again safely if its response was lost.
+// The part's data is not copied, it must outlive the request.
+class SendMessagePart : public Header {
+ public:
+  SendMessagePart(const types::ClientID &sender_id,
+                  const types::ClientID &target_id,
+                  const types::MessageType &type,
+                  const types::ContentSize &content_size,
+                  const types::MessageID &transfer_id,
+                  const types::ContentSize &offset, const char *data,
+                  std::size_t size);
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
 
  private:
   types::ClientID target_id_;
   types::MessageType type_;
-  types::Content content_;
+  types::ContentSize content_size_;
+  types::MessageID transfer_id_;
+  types::ContentSize offset_;
+  const char *data_;
+  std::size_t size_;
+};
+
+// Asks for the pending messages, starting from the message with the given
+// id (or the one after it), and continues its content from 'offset'.
+// The messages that precede it are deleted, as they were received, while
+// the ones it returns are kept until they're confirmed the same way.
+class RetrievePendingMessagesFrom : public Header {
+ public:
+  RetrievePendingMessagesFrom(const types::ClientID &sender_id,
+                              const types::MessageID &from,
+                              const types::ContentSize &offset);
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
+
+ private:
+  types::MessageID from_;
+  types::ContentSize offset_;
+};
+
+// Subscribes to the pending messages, starting from the message with the
+// given id (or the one after it). The server keeps the connection, and
+// pushes the messages over it as they arrive, in batches. Each batch is
+// a response::PendingMessages, and a batch with no messages is a heartbeat.
+// Every batch is confirmed with a SubscriptionAcknowledgment before the
+// server sends the next one.
+class SubscribePendingMessages : public Header {
+ public:
+  SubscribePendingMessages(const types::ClientID &sender_id,
+                           const types::MessageID &from);
+  void send(boost::asio::ip::tcp::socket &socket,
+            bool keep_alive = false) const override;
+
+ private:
+  types::MessageID from_;
 };
 
-class RetrievePendingMessages : public Header {
+// Confirms a batch of a subscription with the id of the first message
+// we didn't receive yet, the server deletes the ones before it.
+// It's only sent over a subscribed connection, so it has no header.
+class SubscriptionAcknowledgment {
  public:
-  RetrievePendingMessages(const types::ClientID &sender_id);
-  void send(boost::asio::ip::tcp::socket &socket) const override;
+  SubscriptionAcknowledgment(const types::MessageID &next) : next_(next) {}
+  void send(boost::asio::ip::tcp::socket &socket) const;
+
+ private:
+  types::MessageID next_;
 };
 
 }  // namespace request
@@ -1,7 +1,8 @@
 #include "response.hpp"
 
-#include <fstream>
+#include <algorithm>
 
+#include "../metrics.hpp"
 #include "exceptions.hpp"
 #include "types.hpp"
 
@@ -10,6 +11,15 @@ namespace protocol {
 namespace response {
 
 namespace {
+// The size of each client in the client list
+constexpr auto kClientSize = types::kClientIDSize + types::kUsernameSize;
+
+// The size of the fields that precede the content of each pending message
+constexpr auto kMessageHeaderSize = types::kClientIDSize +
+                                    types::kMessageIDSize +
+                                    types::kMessageTypeSize +
+                                    types::kContentSizeSize;
+
 // Reads from the socket exactly 'size' bytes
 void read_all(boost::asio::ip::tcp::socket &socket, unsigned char *data,
               size_t count) {
@@ -24,13 +34,21 @@ void read_all(boost::asio::ip::tcp::socket &socket, unsigned char *data,
 
 Header::Header(const types::Code &expected_code,
                boost::asio::ip::tcp::socket &socket) {
+  Read(expected_code, socket);
+}
+
+void Header::Read(const types::Code &expected_code,
+                  boost::asio::ip::tcp::socket &socket) {
   constexpr auto header_size =
       types::kVersionSize + types::kCodeSize + types::kPayloadSizeSize;
+  // The time it takes the server to answer, and the size of the answer
+  metrics::Timer timer(metrics::Phase::kResponse);
   unsigned char data[header_size];
   read_all(socket, data, sizeof(data));
   server_version_ = data;
   code_ = data + types::kVersionSize;
   payload_size_ = data + types::kVersionSize + types::kCodeSize;
+  timer.add_bytes(header_size + payload_size_.value());
 
   if (code_ == kGeneralError) throw exceptions::GeneralError();
   if (code_ != expected_code)
@@ -46,30 +64,48 @@ Register::Register(boost::asio::ip::tcp::socket &socket)
 }
 
 ClientList::ClientList(boost::asio::ip::tcp::socket &&socket)
-    : Header(kClientListCode, socket), socket_(std::move(socket)) {
-  constexpr auto client_size = types::kClientIDSize + types::kUsernameSize;
-  client_count_ = payload_size_.value() / client_size;
+    : ClientList(kClientListCode, std::move(socket)) {}
+
+ClientList::ClientList(const types::Code &expected_code,
+                       boost::asio::ip::tcp::socket &&socket)
+    : Header(expected_code, socket),
+      reader_(std::move(socket), payload_size_.value()) {
+  client_count_ = payload_size_.value() / kClientSize;
 }
 
 void ClientList::ReadClients(
     std::function<void(Client &client)> proccess_client) {
   while ((client_count_--)) {
+    // Many clients are buffered by each read, so they're decoded in place
+    auto data = reader_.Take(kClientSize);
     Client client;
-    read_all(socket_, client.id.data(), types::kClientIDSize);
-    read_all(socket_, client.name.data(), types::kUsernameSize);
+    std::copy(data, data + types::kClientIDSize, client.id.begin());
+    std::copy(data + types::kClientIDSize, data + kClientSize,
+              client.name.begin());
 
     proccess_client(client);
   }
   client_count_ = 0;
 }
 
+ClientListSince::ClientListSince(boost::asio::ip::tcp::socket &&socket)
+    : ClientList(kClientListSinceCode, std::move(socket)) {
+  if (payload_size_.value() < types::kTimestampSize)
+    throw exceptions::PayloadMismatch(types::kTimestampSize, payload_size_);
+  version_ = reader_.Take(types::kTimestampSize);
+  client_count_ = (payload_size_.value() - types::kTimestampSize) / kClientSize;
+}
+
 PublicKey::PublicKey(boost::asio::ip::tcp::socket &socket)
     : Header(kPublicKeyCode, socket) {
   constexpr auto payload_size = types::kClientIDSize + types::kPublicKeySize;
   if (payload_size != payload_size_)
     throw exceptions::PayloadMismatch(payload_size, payload_size_);
-  read_all(socket, target_id.data(), types::kClientIDSize);
-  read_all(socket, target_public_key.data(), types::kPublicKeySize);
+  unsigned char data[payload_size];  // read the whole payload at once
+  read_all(socket, data, sizeof(data));
+  std::copy(data, data + types::kClientIDSize, target_id.begin());
+  std::copy(data + types::kClientIDSize, data + payload_size,
+            target_public_key.begin());
 }
 
 MessageSent::MessageSent(boost::asio::ip::tcp::socket &socket)
@@ -77,78 +113,154 @@ MessageSent::MessageSent(boost::asio::ip::tcp::socket &socket)
   constexpr auto payload_size = types::kClientIDSize + types::kMessageIDSize;
   if (payload_size != payload_size_)
     throw exceptions::PayloadMismatch(payload_size, payload_size_);
-  read_all(socket, target_id.data(), types::kClientIDSize);
-
-  unsigned char data[types::kMessageIDSize];
+  unsigned char data[payload_size];  // read the whole payload at once
   read_all(socket, data, sizeof(data));
-  message_id = data;
+  std::copy(data, data + types::kClientIDSize, target_id.begin());
+  message_id = data + types::kClientIDSize;
 }
 
-Message::Message(Message &&other) : content_(other.content_) {
-  other.content_ = nullptr;
-}
+MessageBatchSent::MessageBatchSent(boost::asio::ip::tcp::socket &socket,
+                                   std::size_t count)
+    : Header(kMessageBatchSentCode, socket) {
+  constexpr auto sent_size = types::kClientIDSize + types::kMessageIDSize;
+  types::PayloadSize payload_size =
+      static_cast<types::PayloadSize::DataType>(sent_size * count);
+  if (payload_size != payload_size_)
+    throw exceptions::PayloadMismatch(payload_size, payload_size_);
+  std::vector<unsigned char> data(payload_size.value());
+  read_all(socket, data.data(), data.size());
 
-types::Content Message::content() {
-  if (!content_) throw std::runtime_error("message content does not exist");
-  return *content_;
+  messages.resize(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    auto position = data.data() + i * sent_size;
+    std::copy(position, position + types::kClientIDSize,
+              messages[i].target_id.begin());
+    messages[i].message_id = position + types::kClientIDSize;
+  }
 }
 
-// Deletes old content if exist.
-void Message::CreateContent(const std::string &filename) {
-  if (content_) delete content_;
-  content_ = new types::Content(filename);
+MessagePartReceived::MessagePartReceived(boost::asio::ip::tcp::socket &socket)
+    : Header(kMessagePartReceivedCode, socket) {
+  constexpr auto payload_size = types::kClientIDSize + types::kMessageIDSize +
+                                types::kContentSizeSize +
+                                types::kMessageIDSize;
+  if (payload_size != payload_size_)
+    throw exceptions::PayloadMismatch(payload_size, payload_size_);
+  unsigned char data[payload_size];  // read the whole payload at once
+  read_all(socket, data, sizeof(data));
+  std::copy(data, data + types::kClientIDSize, target_id.begin());
+  auto position = data + types::kClientIDSize;
+  transfer_id = position;
+  received = position + types::kMessageIDSize;
+  message_id = position + types::kMessageIDSize + types::kContentSizeSize;
 }
 
-PendingMessages::PendingMessages(boost::asio::ip::tcp::socket &&socket)
-    : Header(kPendingMessagesCode, socket), socket_(std::move(socket)) {}
+PendingMessages::PendingMessages(boost::asio::ip::tcp::socket &&socket,
+                                 Resume resume)
+    : Header(kPendingMessagesCode, socket),
+      reader_(std::move(socket), payload_size_.value()),
+      resume_(resume) {}
 
-void PendingMessages::ReadMessages(
-    std::function<void(Message &message)> proccess_message) {
-  constexpr auto message_header_size =
-      types::kClientIDSize + types::kMessageIDSize + types::kMessageTypeSize +
-      types::kContentSizeSize;
-
-  while (payload_size_.value() >= message_header_size) {
-    payload_size_ -= message_header_size;
+template <typename Function>
+auto PendingMessages::Resumable(Function read) {
+  while (true) {
+    try {
+      if (broken_) Reopen();
+      return read();
+    } catch (const boost::system::system_error &) {
+      if (!resume_ || resumes_ == kMaxResumes) throw;
+      ++resumes_;
+      broken_ = true;
+    }
+  }
+}
 
+void PendingMessages::StreamMessages(
+    std::function<void(Message &message, const types::ContentReader &read)>
+        proccess_message) {
+  while (payload_size_.value() >= kMessageHeaderSize) {
     Message message;
-    read_all(socket_, message.sender_id.data(), types::kClientIDSize);
-
-    // Read literal values
-    unsigned char data[types::kMessageIDSize + types::kMessageTypeSize +
-                       types::kContentSizeSize];
-    read_all(socket_, data, sizeof(data));
-    message.id = data;
-    message.type = data + types::kMessageIDSize;
-    types::ContentSize content_size(data + types::kMessageIDSize +
-                                    types::kMessageTypeSize);
-
-    // Read content if exists
-    if (content_size.value()) {
-      if (payload_size_.value() < content_size.value())
-        throw exceptions::ContentMismatch();
-      payload_size_ -= content_size;
-
-      using SizeT = types::ContentSize::DataType;
-      message.CreateContent(
-          "message_" + std::to_string(message.id.value()));  // message_{id}
-      std::ofstream content_file(message.content()->path(),
-                                 std::ofstream::binary);
-      SizeT read_size{0};
-      for (SizeT read = 0; read < content_size.value(); read += read_size) {
-        char data[types::kBlockSize]{0};
-        auto to_read_size = content_size.value() - read;
-        if (to_read_size > types::kBlockSize)  // limit the amount you read
-          to_read_size = types::kBlockSize;
-        read_size =
-            boost::asio::read(socket_, boost::asio::buffer(data, to_read_size));
-        // write as much as you actually read
-        content_file.write(data, read_size);
+    types::ContentSize content_size;
+    ReadMessageHeader(message, content_size);
+    auto left = content_size.value();
+    auto &block = Block();
+    auto read_block = [&]() {
+      auto read_size = ReadContent(
+          block.data(), std::min<decltype(left)>(left, block.size()));
+      left -= read_size;
+      return read_size;
+    };
+
+    proccess_message(message, [&](const types::ContentWriter &write) {
+      while (left) {
+        auto read_size = read_block();
+        write(block.data(), read_size);
       }
-    }
+    });
+
+    while (left) read_block();  // skip what wasn't read
+  }
+}
+
+void PendingMessages::ReadMessageHeader(Message &message,
+                                        types::ContentSize &content_size) {
+  auto data = Resumable([&]() { return reader_.Take(kMessageHeaderSize); });
+  payload_size_ -= kMessageHeaderSize;
+  std::copy(data, data + types::kClientIDSize, message.sender_id.begin());
+
+  // Read literal values
+  data += types::kClientIDSize;
+  message.id = data;
+  message.type = data + types::kMessageIDSize;
+  content_size = data + types::kMessageIDSize + types::kMessageTypeSize;
+
+  if (payload_size_.value() < content_size.value())
+    throw exceptions::ContentMismatch();
+  payload_size_ -= content_size;
+
+  started_ = true;
+  message_id_ = message.id;
+  content_read_ = 0;
+  content_left_ = content_size.value();
+}
+
+std::vector<char> &PendingMessages::Block() {
+  if (block_.empty()) block_.resize(types::block_size());
+  return block_;
+}
+
+std::size_t PendingMessages::ReadContent(char *data, std::size_t size) {
+  auto read_size = Resumable([&]() { return reader_.ReadSome(data, size); });
+  content_read_ += read_size;
+  content_left_ -= read_size;
+  return read_size;
+}
+
+void PendingMessages::Reopen() {
+  // A message whose content was read to its end was received,
+  // so the response continues from the message after it.
+  bool inside_content = started_ && content_left_;
+  types::MessageID from = started_ ? message_id_.value() + !inside_content : 0;
+  auto socket = resume_(from, inside_content ? content_read_ : 0);
+  Read(kPendingMessagesCode, socket);
+  reader_ = reader::BufferedReader(std::move(socket), payload_size_.value());
 
-    proccess_message(message);
+  if (inside_content) {
+    // The message is sent again with the rest of its content
+    if (payload_size_.value() < kMessageHeaderSize)
+      throw exceptions::ContentMismatch();
+    auto data = reader_.Take(kMessageHeaderSize);
+    types::MessageID id = data + types::kClientIDSize;
+    types::ContentSize content_size =
+        data + types::kClientIDSize + types::kMessageIDSize +
+        types::kMessageTypeSize;
+    payload_size_ -= kMessageHeaderSize;
+    if (id != message_id_ || content_size.value() != content_left_ ||
+        payload_size_.value() < content_size.value())
+      throw exceptions::ContentMismatch();
+    payload_size_ -= content_size;
   }
+  broken_ = false;
 }
 
 }  // namespace response
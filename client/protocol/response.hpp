@@ -2,7 +2,9 @@
 #define CLIENT_PROTOCOL_RESPONSE_H
 
 #include <boost/asio.hpp>
+#include <vector>
 
+#include "reader.hpp"
 #include "types.hpp"
 
 namespace messageu {
@@ -12,8 +14,14 @@ namespace response {
 constexpr types::Code::DataType kRegisterCode = 2100, kClientListCode = 2101,
                                 kPublicKeyCode = 2102, kMessageSentCode = 2103,
                                 kPendingMessagesCode = 2104,
+                                kClientListSinceCode = 2105,
+                                kMessagePartReceivedCode = 2106,
+                                kMessageBatchSentCode = 2108,
                                 kGeneralError = 9000;
 
+// The amount of times a response may be resumed after its connection dropped
+constexpr std::size_t kMaxResumes = 3;
+
 // The constructor of each of the response types
 // deserializes the response directely from an open socket.
 // It may throw:
@@ -33,6 +41,10 @@ class Header {
   types::PayloadSize payload_size_;
   Header(const types::Code &expected_code,
          boost::asio::ip::tcp::socket &socket);
+
+  // Internal function that reads the header from the socket.
+  void Read(const types::Code &expected_code,
+            boost::asio::ip::tcp::socket &socket);
 };
 
 struct Register : public Header {
@@ -58,11 +70,33 @@ class ClientList : public Header {
   // The amount of clients available in the socket.
   types::PayloadSize::DataType client_count() { return client_count_; }
 
- private:
-  boost::asio::ip::tcp::socket socket_;
+  // Gives back the ownership over the socket,
+  // should only be used once the whole response has been read.
+  boost::asio::ip::tcp::socket ReleaseSocket() {
+    return reader_.ReleaseSocket();
+  }
+
+ protected:
+  ClientList(const types::Code &expected_code,
+             boost::asio::ip::tcp::socket &&socket);
+
+  reader::BufferedReader reader_;
   types::PayloadSize::DataType client_count_;
 };
 
+// The clients that changed since the version that was asked for,
+// use 'ReadClients' to read them.
+class ClientListSince : public ClientList {
+ public:
+  ClientListSince(boost::asio::ip::tcp::socket &&socket);
+
+  // The version of the list, to ask for the next changes with.
+  types::Timestamp version() const { return version_; }
+
+ private:
+  types::Timestamp version_;
+};
+
 struct PublicKey : public Header {
   types::ClientID target_id;
   types::PublicKey target_public_key;
@@ -75,45 +109,106 @@ struct MessageSent : public Header {
   MessageSent(boost::asio::ip::tcp::socket &socket);
 };
 
-class Message {
- public:
+// A MessageSent for each of the messages of a batch, in the same order.
+struct MessageBatchSent : public Header {
+  struct Sent {
+    types::ClientID target_id;
+    types::MessageID message_id;
+  };
+  std::vector<Sent> messages;
+
+  // 'count' is the amount of messages that were sent in the batch.
+  MessageBatchSent(boost::asio::ip::tcp::socket &socket, std::size_t count);
+};
+
+// The state of a transfer, after a part of it was sent.
+struct MessagePartReceived : public Header {
+  types::ClientID target_id;
+  types::MessageID transfer_id;
+  types::ContentSize received;  // the amount of the content the server has
+  types::MessageID message_id;  // zero until the whole content arrived
+  MessagePartReceived(boost::asio::ip::tcp::socket &socket);
+};
+
+struct Message {
   // Supposed to be used along with the 'PendingMessages' class.
   types::ClientID sender_id;
   types::MessageID id;
   types::MessageType type;
-
-  // Throws std::runtime_error if content
-  // does not exist.
-  types::Content content();
-
-  // Deletes old content if exist.
-  void CreateContent(const std::string &filename);
-
-  Message() = default;
-  Message(Message &) = delete;
-  Message(Message &&other);
-  ~Message() { delete content_; }
-
- private:
-  types::Content *content_ = nullptr;
 };
 
 class PendingMessages : public Header {
  public:
-  PendingMessages(boost::asio::ip::tcp::socket &&socket);
-
-  // Reads the messages from the socket, and passes them
-  // one by one to a given function.
+  // Asks for the rest of the response over a new connection: the messages
+  // from the one with the given id, with the content of that message
+  // from the given offset.
+  using Resume = std::function<boost::asio::ip::tcp::socket(
+      const types::MessageID &from, const types::ContentSize &offset)>;
+
+  // If the connection drops while the messages are read, and 'resume'
+  // is given, the response continues over the connection it returns,
+  // from the point it stopped at. It's invisible to the functions
+  // the messages are passed to.
+  PendingMessages(boost::asio::ip::tcp::socket &&socket,
+                  Resume resume = nullptr);
+
+  // Reads the messages from the socket, and passes them one by one
+  // to a given function, along with a reader of their content.
+  // The content is not stored, the reader passes it straight from the
+  // socket, block after block, to a writer. The part of the content
+  // the function doesn't read is skipped once it returns.
   //
   // throws ContentMismatch if the content size doesn't match
   // the payload size.
-  void ReadMessages(std::function<void(Message &message)> proccess_message);
+  void StreamMessages(std::function<void(Message &message,
+                                         const types::ContentReader &read)>
+                          proccess_message);
 
   // Checks if any messages available in the socket.
   operator bool() const { return payload_size_.value(); }
 
+  // The id of the last message that was read, zero if none was.
+  types::MessageID last_message_id() const {
+    return started_ ? message_id_
+                    : static_cast<types::MessageID::DataType>(0);
+  }
+
+  // Gives back the ownership over the socket,
+  // should only be used once the whole response has been read.
+  boost::asio::ip::tcp::socket ReleaseSocket() {
+    return reader_.ReleaseSocket();
+  }
+
  private:
-  boost::asio::ip::tcp::socket socket_;
+  // Internal function that reads the header of the next message.
+  void ReadMessageHeader(Message &message, types::ContentSize &content_size);
+
+  // Internal function that returns the block the contents are read into,
+  // it's allocated once, and reused for all of the messages.
+  std::vector<char> &Block();
+
+  // Internal function that reads the content of the current message.
+  std::size_t ReadContent(char *data, std::size_t size);
+
+  // Internal function that runs a read, and resumes the response
+  // (and runs it again) if the connection drops.
+  template <typename Function>
+  auto Resumable(Function read);
+
+  // Internal function that reopens the response where it stopped.
+  void Reopen();
+
+  reader::BufferedReader reader_;
+  std::vector<char> block_;
+  Resume resume_;
+  std::size_t resumes_ = 0;
+  bool broken_ = false;  // the connection dropped, and wasn't reopened yet
+
+  // Where the response stopped: the last message whose header
+  // was read (if any), and the amount of its content that was read
+  bool started_ = false;
+  types::MessageID message_id_;
+  types::ContentSize::DataType content_read_ = 0, content_left_ = 0;
 };
 
 }  // namespace response
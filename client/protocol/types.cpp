@@ -1,29 +1,130 @@
 #include "types.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
 namespace messageu {
 namespace protocol {
 namespace types {
-Content::Content(const std::string& filename)
-    : reference_count_(new std::size_t),
-      dump_file_(new tempfile::TempFile(filename)) {
-  *reference_count_ = 1;
+
+namespace {
+// Zero while it waits to be picked from a socket
+std::atomic<std::size_t> block_size_setting(kDefaultBlockSize);
+}  // namespace
+
+void set_block_size(std::size_t size) {
+  block_size_setting = size ? std::clamp(size, kMinBlockSize, kMaxBlockSize)
+                            : 0;
+}
+
+std::size_t block_size() {
+  auto size = block_size_setting.load();
+  return size ? size : kDefaultBlockSize;
 }
 
-Content::Content(Content& other)
-    : reference_count_(other.reference_count_), dump_file_(other.dump_file_) {
-  ++(*reference_count_);
+void TuneBlockSize(std::size_t receive_buffer_size) {
+  std::size_t untuned = 0;
+  block_size_setting.compare_exchange_strong(
+      untuned, std::clamp(receive_buffer_size, kMinBlockSize, kMaxBlockSize));
+}
+
+std::atomic<std::size_t> Content::memory_threshold_(kDefaultMemoryThreshold);
+
+Content::Content(const std::string& filename) : storage_(new Storage) {
+  storage_->filename = filename;
+}
+
+Content::Content(const Content& other) : storage_(other.storage_) {
+  ++storage_->reference_count;
 }
 
 Content::~Content() {
-  if (!(--(*reference_count_))) {
-    delete reference_count_;
-    delete dump_file_;
+  if (!(--storage_->reference_count)) {
+    delete storage_->dump_writer;
+    delete storage_->dump_file;
+    delete storage_;
+  }
+}
+
+std::uintmax_t Content::size() const { return storage_->size; }
+
+bool Content::in_memory() const { return !storage_->dump_file; }
+
+const std::string& Content::buffer() const {
+  if (!in_memory()) throw std::logic_error("the content is not in memory");
+  return storage_->buffer;
+}
+
+const tempfile::TempFile& Content::file() const {
+  if (in_memory()) throw std::logic_error("the content is not in a file");
+  Flush();
+  return *storage_->dump_file;
+}
+
+void Content::Write(const char* data, std::size_t size) {
+  if (in_memory() && storage_->size + size > memory_threshold_) Spill();
+
+  if (in_memory())
+    storage_->buffer.append(data, size);
+  else
+    storage_->dump_writer->write(data, size);
+  CheckDumpWriter();
+  storage_->size += size;
+}
+
+void Content::Reserve(std::uintmax_t size) {
+  if (!in_memory()) return;
+  if (size > memory_threshold_)
+    Spill();
+  else
+    storage_->buffer.reserve(size);
+}
+
+void Content::Read(const ContentWriter& consume) const {
+  if (in_memory()) {
+    if (storage_->size) consume(storage_->buffer.data(), storage_->size);
+    return;
+  }
+
+  Flush();
+  std::ifstream content_file(storage_->dump_file->path(),
+                             std::ifstream::binary);
+  std::vector<char> data(block_size());  // large blocks, fewer writes
+  while (content_file) {
+    content_file.read(data.data(), data.size());
+    if (content_file.gcount())  // pass as much as you actually read
+      consume(data.data(), content_file.gcount());
   }
 }
 
-const tempfile::TempFile& Content::operator*() const { return *dump_file_; }
-const tempfile::TempFile* Content::operator->() const { return dump_file_; }
+void Content::set_memory_threshold(std::size_t threshold) {
+  memory_threshold_ = threshold;
+}
+
+std::size_t Content::memory_threshold() { return memory_threshold_; }
+
+void Content::Spill() {
+  storage_->dump_file = new tempfile::TempFile(storage_->filename);
+  storage_->dump_writer = new std::ofstream(storage_->dump_file->path(),
+                                            std::ofstream::binary);
+  storage_->dump_writer->write(storage_->buffer.data(),
+                               storage_->buffer.size());
+  CheckDumpWriter();
+  std::string().swap(storage_->buffer);  // release the memory
+}
+
+void Content::Flush() const {
+  if (!storage_->dump_writer) return;
+  storage_->dump_writer->flush();
+  CheckDumpWriter();
+}
+
+void Content::CheckDumpWriter() const {
+  if (storage_->dump_writer && !*storage_->dump_writer)
+    throw std::runtime_error("can not write the content to " +
+                             storage_->dump_file->path().string());
+}
 
 }  // namespace types
 }  // namespace protocol
-}  // namespace messageu
\ No newline at end of file
+}  // namespace messageu
@@ -2,8 +2,12 @@
 #define CLIENT_PROTOCOL_TYPES_H
 
 #include <array>
+#include <atomic>
 #include <cstddef>
+#include <fstream>
+#include <functional>
 #include <iosfwd>
+#include <string>
 #include <vector>
 
 #include "../tempfile.hpp"
@@ -12,9 +16,22 @@ namespace messageu {
 namespace protocol {
 namespace types {
 
-// The size of the block of data we'll
-// read / write to the server.
-constexpr size_t kBlockSize = 1024;
+// Contents are read from / written to the server in blocks of the block
+// size, content that is produced on the fly is gathered into them.
+// Larger blocks mean fewer system calls, which is what fast links need.
+constexpr std::size_t kDefaultBlockSize = 256 * 1024;
+constexpr std::size_t kMinBlockSize = 4 * 1024;
+constexpr std::size_t kMaxBlockSize = 64 * 1024 * 1024;
+
+// The block size applies to transfers that start from now on.
+// Zero asks to pick it from the receive buffer of the first socket
+// that connects (see TuneBlockSize), the default is used until then.
+void set_block_size(std::size_t size);
+std::size_t block_size();
+
+// Picks the block size from the size of the receive buffer of a socket,
+// only if it was asked to, and only the first time.
+void TuneBlockSize(std::size_t receive_buffer_size);
 
 constexpr std::size_t kByteToBit = 8;
 
@@ -28,7 +45,7 @@ class LiteralType {
 
   // Parses the type from raw data,
   // the raw data is expected to be of size 'SIZE'
-  LiteralType(unsigned char* raw_data) : value_(0) {
+  LiteralType(const unsigned char* raw_data) : value_(0) {
     // Convert to data type
     for (std::size_t i = 0; i < SIZE; ++i)  // little-endian to host
       value_ |= (static_cast<DataType>(raw_data[i]) << (i * kByteToBit));
@@ -77,18 +94,31 @@ constexpr std::size_t kPayloadSizeSize = 4;
 using PayloadSize = LiteralType<std::uint32_t, kPayloadSizeSize>;
 
 constexpr std::size_t kMessageIDSize = 4;
-using MessageID = LiteralType<std::uint16_t, kMessageIDSize>;
+using MessageID = LiteralType<std::uint32_t, kMessageIDSize>;
 
 constexpr std::size_t kMessageTypeSize = 1;
 using MessageType = LiteralType<std::uint8_t, kMessageTypeSize>;
 namespace MessageTypes {
+// ChunkedFile is a file encrypted in authenticated chunks, and is only
+// sent to clients that declared they can read it.
 constexpr MessageType::DataType SymmetricKeyRequest = 1, SymmetricKey = 2,
-                                TextMessage = 3, File = 4;
+                                TextMessage = 3, File = 4, ChunkedFile = 5;
 }  // namespace MessageTypes
 
+// The content of a symmetric key request may hold a single byte
+// of flags, that declares what the requesting client can read.
+// Older clients send an empty content, and ignore this one.
+namespace Capabilities {
+constexpr unsigned char ChunkedFiles = 1;
+}  // namespace Capabilities
+
 constexpr std::size_t kContentSizeSize = 4;
 using ContentSize = LiteralType<std::uint32_t, kContentSizeSize>;
 
+// Seconds since the unix epoch
+constexpr std::size_t kTimestampSize = 8;
+using Timestamp = LiteralType<std::uint64_t, kTimestampSize>;
+
 constexpr std::size_t kClientIDSize = 16;
 using ClientID = std::array<unsigned char, kClientIDSize>;
 
@@ -98,26 +128,89 @@ using PublicKey = std::array<unsigned char, kPublicKeySize>;
 constexpr std::size_t kUsernameSize = 255;
 using Username = std::array<unsigned char, kUsernameSize>;
 
+// Receives a content, chunk after chunk
+using ContentWriter = std::function<void(const char* data, std::size_t size)>;
+
+// Produces a content on the fly, and passes it to a writer
+using ContentProducer = std::function<void(const ContentWriter& write)>;
+
+// Reads a content that isn't stored, and passes it to a writer
+using ContentReader = std::function<void(const ContentWriter& write)>;
+
+// The default size (in bytes) up to which a content is held in memory
+constexpr std::size_t kDefaultMemoryThreshold = 64 * 1024;
+
 // We are not allowed to use smart pointer
+//
+// The content have a dynamic size, a small content is held in memory,
+// and once it grows beyond the memory threshold, it spills into a
+// temporary file. Copies share the same underlying content, and may be
+// released by different threads.
 class Content {
  public:
   // Name the dump_file.
   // A good name can be the message_id, if exists.
   Content(const std::string& filename);
-  Content(Content& other);
+  Content(const Content& other);
   ~Content();
 
-  // Get the tempfile.
-  // generally, use this to read & write
-  const tempfile::TempFile& operator*() const;
-  const tempfile::TempFile* operator->() const;
+  std::uintmax_t size() const;
+
+  // Whether the content is held in memory, or in the dump file
+  bool in_memory() const;
+
+  // The content itself, only valid while it's held in memory.
+  const std::string& buffer() const;
+
+  // The dump file, only valid once the content spilled to disk.
+  const tempfile::TempFile& file() const;
+
+  // Appends data to the end of the content.
+  //
+  // Throws std::runtime_error if the content spilled to the dump file,
+  // and it can't be written.
+  void Write(const char* data, std::size_t size);
+
+  // Tells the content how big it's about to grow,
+  // so it can spill into the dump file right away.
+  //
+  // Throws std::runtime_error if the dump file can't be written.
+  void Reserve(std::uintmax_t size);
+
+  // Passes the content, block after block, to a writer.
+  void Read(const ContentWriter& consume) const;
+
+  // The threshold applies to contents that grow from now on.
+  static void set_memory_threshold(std::size_t threshold);
+  static std::size_t memory_threshold();
+
+  // Copies should share the content
+  Content& operator=(const Content&) = delete;
 
  private:
-  std::size_t* reference_count_;
+  struct Storage {
+    std::atomic<std::size_t> reference_count{1};
+    std::string filename;
+    std::uintmax_t size = 0;
+    std::string buffer;  // holds the content while it's in memory
+
+    // Holds the content once it spills
+    tempfile::TempFile* dump_file = nullptr;
+    std::ofstream* dump_writer = nullptr;
+  };
+
+  // Moves the content from memory into the dump file
+  void Spill();
+
+  // Makes sure everything written so far reached the dump file
+  void Flush() const;
+
+  // Internal function that throws std::runtime_error if a write
+  // to the dump file failed.
+  void CheckDumpWriter() const;
 
-  // The content have a dynamic size, so
-  // we save it in a temporary file.
-  tempfile::TempFile* dump_file_;
+  static std::atomic<std::size_t> memory_threshold_;
+  Storage* storage_;
 };
 
 }  // namespace types
@@ -0,0 +1,73 @@
+#include "connection_pool.hpp"
+
+#include "../metrics.hpp"
+#include "../protocol/types.hpp"
+
+namespace messageu {
+namespace session {
+
+boost::asio::ip::tcp::socket ConnectionPool::Connect() {
+  metrics::Timer timer(metrics::Phase::kConnect);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (server_address_.empty())
+      server_address_ = resolver_.resolve(ip_, port_);
+  }
+
+  boost::asio::ip::tcp::socket socket(io_context_);
+  boost::asio::connect(socket, server_address_);
+  // A request is written in several small pieces, we don't
+  // want to wait for an ack between them.
+  socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+  // A block that fits the receive buffer is read in a single call
+  boost::asio::socket_base::receive_buffer_size receive_buffer;
+  socket.get_option(receive_buffer);
+  protocol::types::TuneBlockSize(receive_buffer.value());
+  return socket;
+}
+
+boost::asio::ip::tcp::socket ConnectionPool::Acquire(bool &reused) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto now = std::chrono::steady_clock::now();
+    // Prefer the most recent connection, it's the least likely to be closed
+    while (!idle_.empty()) {
+      auto connection = std::move(idle_.back());
+      idle_.pop_back();
+      if (now - connection.since < kIdleTimeout && IsAlive(connection.socket)) {
+        reused = true;
+        return std::move(connection.socket);
+      }
+    }
+  }
+
+  reused = false;
+  return Connect();
+}
+
+void ConnectionPool::Release(boost::asio::ip::tcp::socket &&socket) {
+  if (!socket.is_open()) return;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if (idle_.size() >= kMaxIdleConnections) idle_.pop_front();
+  idle_.push_back(IdleConnection{std::move(socket),
+                                 std::chrono::steady_clock::now()});
+}
+
+bool ConnectionPool::IsAlive(boost::asio::ip::tcp::socket &socket) {
+  // An idle connection should never have anything to read,
+  // a closed one will read EOF.
+  boost::system::error_code error;
+  unsigned char probe;
+  socket.non_blocking(true, error);
+  if (error) return false;
+  socket.receive(boost::asio::buffer(&probe, sizeof(probe)),
+                 boost::asio::socket_base::message_peek, error);
+  bool alive = error == boost::asio::error::would_block;
+  socket.non_blocking(false, error);
+  return alive && !error;
+}
+
+}  // namespace session
+}  // namespace messageu
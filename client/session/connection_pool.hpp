@@ -0,0 +1,74 @@
+// Keeps connections to the server open between requests,
+// so consecutive requests can skip the connect handshake.
+
+#ifndef CLIENT_SESSION_CONNECTION_POOL_H
+#define CLIENT_SESSION_CONNECTION_POOL_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace messageu {
+namespace session {
+
+// The maximum amount of idle connections the pool holds at once.
+constexpr std::size_t kMaxIdleConnections = 8;
+
+// An idle connection is dropped after this period of time,
+// it must be shorter than the keep-alive timeout of the server.
+constexpr std::chrono::seconds kIdleTimeout(30);
+
+class ConnectionPool {
+ public:
+  ConnectionPool(const std::string &ip, const std::string &port)
+      : ip_(ip), port_(port), resolver_(io_context_) {}
+
+  // Opens a new connection to the server
+  //
+  // Throws boost::system::system_error if it fails to connect
+  boost::asio::ip::tcp::socket Connect();
+
+  // Returns an idle connection if there is a healthy one,
+  // otherwise opens a new connection to the server.
+  //
+  // 'reused' is set to whether the connection was used before,
+  // such a connection may still be closed by the server at any moment.
+  //
+  // Throws boost::system::system_error if it fails to connect
+  boost::asio::ip::tcp::socket Acquire(bool &reused);
+
+  // Gives a connection back to the pool, so it can be reused.
+  // Make sure to read the whole response before releasing a connection.
+  void Release(boost::asio::ip::tcp::socket &&socket);
+
+  // The pool owns the io_context of all of its connections
+  ConnectionPool(ConnectionPool &) = delete;
+
+ private:
+  struct IdleConnection {
+    boost::asio::ip::tcp::socket socket;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  // Checks that the server didn't close the connection while it was idle,
+  // without blocking.
+  static bool IsAlive(boost::asio::ip::tcp::socket &socket);
+
+  std::string ip_;
+  std::string port_;
+
+  boost::asio::io_context io_context_;
+  boost::asio::ip::tcp::resolver resolver_;
+  boost::asio::ip::tcp::resolver::results_type server_address_;
+
+  std::mutex lock_;
+  std::deque<IdleConnection> idle_;  // oldest first
+};
+
+}  // namespace session
+}  // namespace messageu
+
+#endif
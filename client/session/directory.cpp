@@ -0,0 +1,109 @@
+#include "directory.hpp"
+
+#include <cstring>
+
+namespace messageu {
+namespace session {
+
+namespace {
+// The size of a new index, has to be a power of two
+constexpr std::size_t kInitialSlots = 64;
+
+// Mixes the bits of a value, so close values land in distant slots
+std::uint64_t mix(std::uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+  return value;
+}
+}  // namespace
+
+ClientDirectory::ClientDirectory()
+    : id_index_(kInitialSlots), username_index_(kInitialSlots) {}
+
+types::Client *ClientDirectory::Add(const protocol::types::ClientID &id,
+                                    const std::string &username) {
+  // Keeps the indexes at most half full, so probes stay short
+  if ((clients_.size() + 1) * 2 > id_index_.size()) Grow();
+
+  auto id_hash = Hash(id), username_hash = Hash(username);
+  auto &id_slot = Probe(id_index_, id, id_hash);
+  auto &username_slot = Probe(username_index_, username, username_hash);
+  if (id_slot.position || username_slot.position) return nullptr;
+
+  auto &client = clients_.emplace_back(id, username);
+  auto position = static_cast<std::uint32_t>(clients_.size());
+  id_slot = {id_hash, position};
+  username_slot = {username_hash, position};
+  return &client;
+}
+
+types::Client *ClientDirectory::Find(const protocol::types::ClientID &id) {
+  auto &slot = Probe(id_index_, id, Hash(id));
+  return slot.position ? &clients_[slot.position - 1] : nullptr;
+}
+
+types::Client *ClientDirectory::Find(const std::string &username) {
+  auto &slot = Probe(username_index_, username, Hash(username));
+  return slot.position ? &clients_[slot.position - 1] : nullptr;
+}
+
+void ClientDirectory::ForEach(
+    std::function<void(types::Client &client)> callback) {
+  for (auto &client : clients_) callback(client);
+}
+
+std::uint64_t ClientDirectory::Hash(const protocol::types::ClientID &id) {
+  // Folds both halves of the id into one value
+  std::uint64_t low, high;
+  std::memcpy(&low, id.data(), sizeof(low));
+  std::memcpy(&high, id.data() + sizeof(low), sizeof(high));
+  return mix(low ^ mix(high));
+}
+
+std::uint64_t ClientDirectory::Hash(const std::string &username) {
+  // FNV-1a
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : username) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return mix(hash);
+}
+
+template <typename Key>
+ClientDirectory::Slot &ClientDirectory::Probe(std::vector<Slot> &index,
+                                              const Key &key,
+                                              std::uint64_t hash) {
+  auto mask = index.size() - 1;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    auto &slot = index[i];
+    // The stored hash is compared first, so a client is only
+    // touched when it's most likely the one we look for.
+    if (!slot.position ||
+        (slot.hash == hash && Matches(clients_[slot.position - 1], key)))
+      return slot;
+  }
+}
+
+void ClientDirectory::Grow() {
+  auto size = id_index_.size() * 2;
+  id_index_.assign(size, Slot{0, 0});
+  username_index_.assign(size, Slot{0, 0});
+
+  // The hashes aren't stored in the clients, so they're computed again
+  std::uint32_t position = 0;
+  for (auto &client : clients_) {
+    ++position;
+    auto id_hash = Hash(client.id());
+    Probe(id_index_, client.id(), id_hash) = {id_hash, position};
+    auto username_hash = Hash(client.username());
+    Probe(username_index_, client.username(), username_hash) = {
+        username_hash, position};
+  }
+}
+
+}  // namespace session
+}  // namespace messageu
@@ -0,0 +1,82 @@
+// A directory of the clients the session knows, that resolves
+// a client by its id or by its username in constant time.
+
+#ifndef CLIENT_SESSION_DIRECTORY_H
+#define CLIENT_SESSION_DIRECTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../protocol/types.hpp"
+#include "types.hpp"
+
+namespace messageu {
+namespace session {
+
+class ClientDirectory {
+  // The clients are stored in large contiguous blocks, and never move
+  // once they're added, so a client can be referenced while others are
+  // added. Both indexes are open-addressing hash tables of slots that
+  // refer to the clients by position, a lookup probes a few neighboring
+  // slots, and only touches the client it found.
+  //
+  // Clients are never removed, as the server never removes them.
+ public:
+  ClientDirectory();
+
+  // Adds a new client, and returns it.
+  // Returns nullptr if the id or the username is already taken.
+  types::Client *Add(const protocol::types::ClientID &id,
+                     const std::string &username);
+
+  // Returns nullptr if there is no such client
+  types::Client *Find(const protocol::types::ClientID &id);
+  types::Client *Find(const std::string &username);
+
+  // Passes the clients to a function, in the order they were added.
+  void ForEach(std::function<void(types::Client &client)> callback);
+
+  std::size_t size() const { return clients_.size(); }
+
+  // The clients are referenced by the session
+  ClientDirectory(ClientDirectory &) = delete;
+
+ private:
+  struct Slot {
+    std::uint64_t hash;
+    std::uint32_t position;  // of the client, plus one, zero when empty
+  };
+
+  static std::uint64_t Hash(const protocol::types::ClientID &id);
+  static std::uint64_t Hash(const std::string &username);
+
+  // Internal function that finds the slot of a key in an index,
+  // or the empty slot the key belongs to if it's not there.
+  template <typename Key>
+  Slot &Probe(std::vector<Slot> &index, const Key &key, std::uint64_t hash);
+
+  // Internal function that doubles the size of both indexes
+  void Grow();
+
+  static bool Matches(const types::Client &client,
+                      const protocol::types::ClientID &id) {
+    return client.id() == id;
+  }
+  static bool Matches(const types::Client &client,
+                      const std::string &username) {
+    return client.username() == username;
+  }
+
+  std::deque<types::Client> clients_;
+  std::vector<Slot> id_index_;
+  std::vector<Slot> username_index_;
+};
+
+}  // namespace session
+}  // namespace messageu
+
+#endif
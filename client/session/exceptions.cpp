@@ -23,6 +23,8 @@ UnknownTarget::UnknownTarget(const std::string &target_username)
     : GeneralError("Could not resolve the username: \"" + target_username +
                    "\"") {}
 
+NoTargets::NoTargets() : GeneralError("There are no targets to send to") {}
+
 UnknownFilePath::UnknownFilePath(const std::string &path)
     : GeneralError("Failed to open " + path) {}
 
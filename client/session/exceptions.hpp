@@ -47,6 +47,12 @@ class UnknownTarget : public GeneralError {
   UnknownTarget(const std::string &target_username);
 };
 
+// A request to several targets was given none
+class NoTargets : public GeneralError {
+ public:
+  NoTargets();
+};
+
 // Can't find the file path
 class UnknownFilePath : public GeneralError {
  public:
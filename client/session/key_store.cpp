@@ -0,0 +1,194 @@
+#include "key_store.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace messageu {
+namespace session {
+
+namespace {
+// Changed whenever the layout of the file changes
+constexpr char kMagic[4] = {'M', 'U', 'K', '2'};
+constexpr unsigned char kHasPublicKey = 1, kHasSymmetricKey = 2,
+                        kChunkedFiles = 4;
+
+// The amount of records a new store has room for
+constexpr std::size_t kInitialCapacity = 64;
+}  // namespace
+
+KeyStore::~KeyStore() {
+  if (region_) region_->flush();
+  Close();
+}
+
+void KeyStore::Load(
+    std::function<void(const protocol::types::ClientID &id,
+                       const std::string &username,
+                       const protocol::types::PublicKey *public_key,
+                       const char *symmetric_key, bool chunked_files)>
+        callback) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open()) return;
+
+  for (auto &[id, index] : index_) {
+    auto *stored = record(index);
+    std::string username(reinterpret_cast<const char *>(stored->username),
+                         protocol::types::kUsernameSize);
+    username = username.substr(0, username.find('\0'));
+    protocol::types::PublicKey public_key;
+    std::copy(std::begin(stored->public_key), std::end(stored->public_key),
+              public_key.begin());
+
+    callback(id, username,
+             (stored->flags & kHasPublicKey) ? &public_key : nullptr,
+             (stored->flags & kHasSymmetricKey)
+                 ? reinterpret_cast<const char *>(stored->symmetric_key)
+                 : nullptr,
+             stored->flags & kChunkedFiles);
+  }
+}
+
+void KeyStore::StoreClient(const protocol::types::ClientID &id,
+                           const std::string &username) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open() || index_.count(id)) return;
+
+  try {
+    auto count = header()->record_count;
+    if (count == capacity()) Map(capacity() * 2);
+
+    auto *stored = record(count);
+    std::memset(stored, 0, sizeof(Record));
+    std::copy(id.begin(), id.end(), stored->id);
+    std::copy_n(username.begin(),
+                std::min(username.size(), protocol::types::kUsernameSize),
+                stored->username);
+    header()->record_count = count + 1;
+    index_[id] = count;
+  } catch (const std::exception &) {
+    Close();
+    failed_ = true;
+  }
+}
+
+void KeyStore::StorePublicKey(const protocol::types::ClientID &id,
+                              const protocol::types::PublicKey &public_key) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open()) return;
+  auto found = index_.find(id);
+  if (found == index_.end()) return;
+
+  auto *stored = record(found->second);
+  std::copy(public_key.begin(), public_key.end(), stored->public_key);
+  stored->flags |= kHasPublicKey;
+}
+
+void KeyStore::StoreSymmetricKey(const protocol::types::ClientID &id,
+                                 const crypto::symmetric::Key &key) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open()) return;
+  auto found = index_.find(id);
+  if (found == index_.end()) return;
+
+  auto *stored = record(found->second);
+  auto raw_key = key.Export();
+  std::copy(raw_key.begin(), raw_key.end(), stored->symmetric_key);
+  stored->flags |= kHasSymmetricKey;
+}
+
+void KeyStore::StoreChunkedFiles(const protocol::types::ClientID &id) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open()) return;
+  auto found = index_.find(id);
+  if (found == index_.end()) return;
+
+  record(found->second)->flags |= kChunkedFiles;
+}
+
+protocol::types::Timestamp KeyStore::LoadListVersion() {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open()) return static_cast<protocol::types::Timestamp::DataType>(0);
+  return header()->list_version;
+}
+
+void KeyStore::StoreListVersion(const protocol::types::Timestamp &version) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!Open()) return;
+  header()->list_version = version.value();
+}
+
+bool KeyStore::Open() {
+  if (region_) return true;
+  if (failed_) return false;
+
+  try {
+    Map(kInitialCapacity);
+    auto *file_header = header();
+    if (std::memcmp(file_header->magic, kMagic, sizeof(kMagic)) ||
+        file_header->record_size != sizeof(Record) ||
+        file_header->record_count > capacity()) {
+      // Not a store we can read (or a new one), start over
+      std::memcpy(file_header->magic, kMagic, sizeof(kMagic));
+      file_header->record_size = sizeof(Record);
+      file_header->record_count = 0;
+      file_header->list_version = 0;
+    }
+
+    for (std::size_t i = 0; i < file_header->record_count; ++i) {
+      protocol::types::ClientID id;
+      std::copy(std::begin(record(i)->id), std::end(record(i)->id),
+                id.begin());
+      index_[id] = i;
+    }
+    return true;
+  } catch (const std::exception &) {
+    Close();
+    failed_ = true;
+    return false;
+  }
+}
+
+void KeyStore::Map(std::size_t capacity) {
+  delete region_;
+  region_ = nullptr;
+  delete file_;
+  file_ = nullptr;
+
+  auto size = sizeof(FileHeader) + capacity * sizeof(Record);
+  if (!std::filesystem::exists(file_path_))
+    std::ofstream(file_path_, std::ofstream::binary);  // creates the file
+  if (std::filesystem::file_size(file_path_) < size)
+    std::filesystem::resize_file(file_path_, size);
+
+  // Maps the whole file, it may be bigger than we asked for
+  file_ = new boost::interprocess::file_mapping(
+      file_path_.string().c_str(), boost::interprocess::read_write);
+  region_ = new boost::interprocess::mapped_region(
+      *file_, boost::interprocess::read_write);
+}
+
+void KeyStore::Close() {
+  delete region_;
+  region_ = nullptr;
+  delete file_;
+  file_ = nullptr;
+  index_.clear();
+}
+
+KeyStore::FileHeader *KeyStore::header() const {
+  return static_cast<FileHeader *>(region_->get_address());
+}
+
+KeyStore::Record *KeyStore::record(std::size_t index) const {
+  auto *records = static_cast<unsigned char *>(region_->get_address()) +
+                  sizeof(FileHeader);
+  return reinterpret_cast<Record *>(records) + index;
+}
+
+std::size_t KeyStore::capacity() const {
+  return (region_->get_size() - sizeof(FileHeader)) / sizeof(Record);
+}
+
+}  // namespace session
+}  // namespace messageu
@@ -0,0 +1,109 @@
+// Keeps the clients we know, and the keys we learned about them,
+// on disk, so a restarted client can talk to its peers right away.
+
+#ifndef CLIENT_SESSION_KEY_STORE_H
+#define CLIENT_SESSION_KEY_STORE_H
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "../crypto/symmetric.hpp"
+#include "../protocol/types.hpp"
+
+namespace messageu {
+namespace session {
+
+class KeyStore {
+  // The store is a file of fixed-size records, one per client, that is
+  // mapped into memory. Once it's loaded, the records are indexed by
+  // the client id, so a key is updated in place, and a new client
+  // is appended to the end of the file.
+  //
+  // The store is only a cache: if the file can't be used, the store
+  // stops persisting, and never throws.
+ public:
+  // The file is only opened once it's used, and created if it doesn't exist.
+  KeyStore(const std::filesystem::path &file) : file_path_(file) {}
+  ~KeyStore();
+
+  // Passes each stored client to a function, along with its keys,
+  // a key is null if it isn't known.
+  void Load(std::function<void(const protocol::types::ClientID &id,
+                               const std::string &username,
+                               const protocol::types::PublicKey *public_key,
+                               const char *symmetric_key, bool chunked_files)>
+                callback);
+
+  // Stores a client, if it's not stored already.
+  void StoreClient(const protocol::types::ClientID &id,
+                   const std::string &username);
+
+  // Stores a key of a client that is already stored,
+  // overwrites the old one if exists.
+  void StorePublicKey(const protocol::types::ClientID &id,
+                      const protocol::types::PublicKey &public_key);
+  void StoreSymmetricKey(const protocol::types::ClientID &id,
+                         const crypto::symmetric::Key &key);
+
+  // Stores that a client, that is already stored, can read chunked files
+  void StoreChunkedFiles(const protocol::types::ClientID &id);
+
+  // The version of the client list the stored clients are up to date
+  // with, zero if there is none.
+  protocol::types::Timestamp LoadListVersion();
+  void StoreListVersion(const protocol::types::Timestamp &version);
+
+  // The store owns its mapping
+  KeyStore(KeyStore &) = delete;
+
+ private:
+  // Only made of bytes, so it has no padding
+  struct Record {
+    unsigned char id[protocol::types::kClientIDSize];
+    unsigned char username[protocol::types::kUsernameSize];
+    unsigned char flags;  // which of the keys are known, and capabilities
+    unsigned char public_key[protocol::types::kPublicKeySize];
+    unsigned char symmetric_key[crypto::symmetric::kKeySize];
+  };
+
+  struct FileHeader {
+    char magic[4];
+    std::uint32_t record_size;
+    std::uint64_t record_count;
+    std::uint64_t list_version;
+  };
+
+  // Internal function that maps the file and indexes its records,
+  // returns false if the file can't be used.
+  bool Open();
+
+  // Internal function that maps the file with room for 'capacity'
+  // records, and creates / grows the file if it's too small.
+  void Map(std::size_t capacity);
+
+  // Internal function that drops the mapping, after a failure
+  void Close();
+
+  FileHeader *header() const;
+  Record *record(std::size_t index) const;
+  std::size_t capacity() const;
+
+  std::filesystem::path file_path_;
+  std::mutex lock_;  // guards everything below
+  bool failed_ = false;
+  boost::interprocess::file_mapping *file_ = nullptr;
+  boost::interprocess::mapped_region *region_ = nullptr;
+  std::map<protocol::types::ClientID, std::size_t> index_;
+};
+
+}  // namespace session
+}  // namespace messageu
+
+#endif
@@ -1,23 +1,111 @@
 #include "session.hpp"
 
+#ifdef WIN32
+#include <winsock2.h>
+#elif __linux__
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <fstream>
-
+#include <future>
+#include <limits>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "../metrics.hpp"
+#include "../parallel.hpp"
+#include "../protocol/exceptions.hpp"
 #include "exceptions.hpp"
 
 namespace messageu {
 namespace session {
 
+namespace {
+// The amount of chunks of a file that are encrypted / decrypted at once,
+// and the amount of threads of the crypto pool
+std::size_t crypto_workers() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// The amount of bytes a message to many clients is encrypted for, in total,
+// from which the encryption is split between the threads of the crypto pool
+constexpr std::size_t kParallelEncryptSize = 256 * 1024;
+
+// The amount of messages each decrypt worker may have in its queue,
+// the download waits once they're all full.
+constexpr std::size_t kOpeningPerWorker = 4;
+
+// The size of each part a large file is sent in, a dropped connection
+// only costs the part that was being sent.
+constexpr std::size_t kPartSize = 4 * 1024 * 1024;
+
+// How often the subscription checks whether it was stopped,
+// while it waits for the server to push messages.
+constexpr int kSubscriptionPollMilliseconds = 200;
+
+// A subscription reconnects after a delay, that doubles
+// with every failed attempt, up to the maximum.
+constexpr std::chrono::seconds kFirstReconnectDelay(1),
+    kMaxReconnectDelay(32);
+
+// Waits for the first byte of the response to a request, without reading it.
+// A connection the server closed while it was idle still takes a request,
+// and only fails once the response is read, so it's read ahead of time.
+//
+// Throws boost::system::system_error if the connection was closed.
+void wait_for_response(boost::asio::ip::tcp::socket &socket) {
+  metrics::Timer timer(metrics::Phase::kResponse);
+  char first;
+  socket.receive(boost::asio::buffer(&first, sizeof(first)),
+                 boost::asio::socket_base::message_peek);
+}
+
+// Waits until there is something to read from a socket, or the timeout
+// passes, and returns whether there is. A socket that failed counts as
+// readable, so the read that follows reports the failure.
+bool wait_for_data(boost::asio::ip::tcp::socket &socket, int milliseconds) {
+  pollfd descriptor{};
+  descriptor.fd = socket.native_handle();
+  descriptor.events = POLLIN;
+#ifdef WIN32
+  return WSAPoll(&descriptor, 1, milliseconds) != 0;
+#elif __linux__
+  return poll(&descriptor, 1, milliseconds) != 0;
+#endif
+}
+
+// The store of keys is kept next to the info file
+std::filesystem::path key_store_path(const std::filesystem::path &info_file) {
+  return std::filesystem::path(info_file).replace_extension(".keys");
+}
+}  // namespace
+
+Session::Session(const config::ServerInfo &server_info)
+    : server_info_(server_info),
+      pool_(server_info_.ip(), server_info_.port()),
+      crypto_pool_(new boost::asio::thread_pool(crypto_workers())) {
+  if (server_info_.decrypt_workers())
+    decrypt_pool_ =
+        new boost::asio::thread_pool(server_info_.decrypt_workers());
+}
+
 Session::Session(const config::ServerInfo &server_info,
                  std::filesystem::path info_file)
-    : server_info_(server_info) {
+    : Session(server_info) {
   try {
     my_info_ = new config::MyInfo(info_file);
   } catch (const std::invalid_argument &) {
     my_info_ = nullptr;
   }
+  key_store_ = new KeyStore(key_store_path(info_file));
 }
 
 void Session::Register(std::string username, std::filesystem::path info_file) {
+  std::unique_lock<std::shared_mutex> guard(lock_);
   if (my_info_) throw session::exceptions::AlreadyRegistered();
   if (username.size() > protocol::types::kUsernameSize)
     throw session::exceptions::UsernameTooLong(username);
@@ -33,231 +121,750 @@ void Session::Register(std::string username, std::filesystem::path info_file) {
 
   // Hopefully, register succeeded, you can save the info.
   auto response = protocol::response::Register(socket);
+  CloseConnection(std::move(socket));
   my_info_ = new config::MyInfo(username, response.client_id, private_key);
   my_info_->Save(info_file);
+
+  // Keys that were stored for another identity are useless now
+  delete key_store_;
+  std::error_code error;  // it's fine if there was no store
+  std::filesystem::remove(key_store_path(info_file), error);
+  key_store_ = new KeyStore(key_store_path(info_file));
 }
 
 void Session::UpdateClientList(
     std::function<void(const std::string &username)> callback) {
+  std::unique_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
-
-  // Reset old tables
-  for (auto &[username, client_ptr] : username_to_client_) {
-    delete client_ptr;
-  }
-  username_to_client_.clear();
-  id_to_client_.clear();
+  LoadKnownClients();
 
   // A complex response that needs an ownership over the socket
-  auto response = protocol::response::ClientList(
-      OpenConnection(protocol::request::ClientList(my_info_->client_id())));
+  auto response =
+      protocol::response::ClientListSince(OpenConnection(
+          protocol::request::ClientListSince(my_info_->client_id(),
+                                             client_list_version_)));
   response.ReadClients([&](protocol::response::Client raw_client) {
+    if (clients_.Find(raw_client.id)) return;  // already known
+
     std::string parsed_name(std::begin(raw_client.name),
                             std::end(raw_client.name));
     // remove all dead characters, this is necessary for map
     parsed_name = parsed_name.substr(0, parsed_name.find('\0'));
-    auto *client = new types::Client(raw_client.id, parsed_name);
-    username_to_client_[parsed_name] = client;
-    id_to_client_[raw_client.id] = client;
-    callback(parsed_name);
+    if (!clients_.Add(raw_client.id, parsed_name)) return;
+    if (key_store_) key_store_->StoreClient(raw_client.id, parsed_name);
   });
+  CloseConnection(response.ReleaseSocket());
+  client_list_version_ = response.version();
+  if (key_store_) key_store_->StoreListVersion(client_list_version_);
+
+  // The list is passed sorted by the username
+  std::vector<const std::string *> usernames;
+  usernames.reserve(clients_.size());
+  clients_.ForEach(
+      [&](types::Client &client) { usernames.push_back(&client.username()); });
+  std::sort(usernames.begin(), usernames.end(),
+            [](const std::string *a, const std::string *b) { return *a < *b; });
+  for (auto *username : usernames) callback(*username);
 }
 
 void Session::GetPublicKey(const std::string &target_username) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
 
   auto &target = ResolveTarget(target_username);
   auto socket = OpenConnection(
       protocol::request::GetPublicKey(my_info_->client_id(), target.id()));
   auto response = protocol::response::PublicKey(socket);
+  CloseConnection(std::move(socket));
   target.set_public_key(response.target_public_key);
+  if (key_store_)
+    key_store_->StorePublicKey(target.id(), response.target_public_key);
 }
 
 void Session::RetrievePendingMessages(
     std::function<void(const types::Message &message)> callback) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
-
-  // A complex response that needs an ownership over the socket
-  auto response = protocol::response::PendingMessages(OpenConnection(
-      protocol::request::RetrievePendingMessages(my_info_->client_id())));
-  response.ReadMessages([&](protocol::response::Message &message) {
-    types::Client *sender;
-    try {
-      sender = id_to_client_.at(message.sender_id);
-    } catch (const std::out_of_range &) {
-      callback(
-          types::ErrorMessage("Unknown", "Can not resolve the sender id."));
+  LoadKnownClients();
+
+  // The server keeps the messages we received until we ask for the ones
+  // that follow them, so we keep asking until there are no more, which
+  // also tells it we have the last ones.
+  std::lock_guard<std::mutex> retrieving(retrieve_lock_);
+  auto resume = [&](const protocol::types::MessageID &from,
+                    const protocol::types::ContentSize &offset) {
+    return OpenConnection(protocol::request::RetrievePendingMessagesFrom(
+        my_info_->client_id(), from, offset));
+  };
+  while (true) {
+    // A complex response that needs an ownership over the socket,
+    // and continues over a new one if the connection drops.
+    auto response = protocol::response::PendingMessages(
+        resume(next_message_,
+               static_cast<protocol::types::ContentSize::DataType>(0)),
+        resume);
+    if (!response) {
+      CloseConnection(response.ReleaseSocket());
       return;
     }
-    try {
-      switch (message.type.value()) {
-        using namespace protocol::types;
-        case MessageTypes::SymmetricKeyRequest:
-          callback(types::SymmetricKeyRequestMessage(sender->username()));
-          break;
-        case MessageTypes::SymmetricKey:
-          sender->set_symmetric_key(DecryptSymmetricKey(*message.content()));
-          callback(types::ReceivedSymmetricKeyMessage(sender->username()));
-          break;
-        case MessageTypes::File: {
-          auto res_msg = types::FileMessage(
-              sender->username(),
-              new tempfile::TempFile(
-                  message.content()->path().filename().string() + ".decrypted",
-                  /*auto_delete=*/false));
-          sender->symmetric_key().Decrypt(*message.content(),
-                                          *res_msg.dump_file_);
-          callback(res_msg);
-        } break;
-        case MessageTypes::TextMessage: {
-          auto res_msg = types::TextMessage(
-              sender->username(),
-              new tempfile::TempFile(
-                  message.content()->path().filename().string() +
-                  ".decrypted"));
-          sender->symmetric_key().Decrypt(*message.content(),
-                                          *res_msg.dump_file_);
-          callback(res_msg);
-        } break;
-        default:
-          // We can't decrypt it...
-          callback(types::EncryptedMessage(sender->username()));
-      }
-    } catch (const CryptoPP::Exception &) {
-      callback(types::EncryptedMessage(sender->username()));
-    } catch (const exceptions::MissingKey &) {
-      callback(types::EncryptedMessage(sender->username()));
-    } catch (const std::runtime_error &e) {
-      callback(types::ErrorMessage(sender->username(), e.what()));
-    }
-  });
+
+    if (decrypt_pool_)
+      OpenMessagesInParallel(response, next_message_, callback);
+    else
+      OpenMessagesInline(response, next_message_, callback);
+    next_message_ = response.last_message_id().value() + 1;
+    CloseConnection(response.ReleaseSocket());
+  }
+}
+
+void Session::Subscribe(
+    std::function<void(const types::Message &message)> callback) {
+  {
+    std::shared_lock<std::shared_mutex> guard(lock_);
+    if (!my_info_) throw session::exceptions::UnauthorizedRequest();
+  }
+  Unsubscribe();
+  subscribed_ = true;
+  subscription_ =
+      std::thread(&Session::RunSubscription, this, std::move(callback));
+}
+
+void Session::Unsubscribe() {
+  {
+    std::lock_guard<std::mutex> guard(subscription_lock_);
+    subscribed_ = false;
+  }
+  subscription_stopped_.notify_all();
+  if (subscription_.joinable()) subscription_.join();
 }
 
 void Session::SendMessage(const std::string &target_username,
                           const std::string &text) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
   auto &target = ResolveTarget(target_username);
 
-  // Write the message to a temp file
-  auto temp_content_file = tempfile::TempFile("new_message.decrypt");
-  std::ofstream content_file(temp_content_file.path());
-  content_file << text;
-  content_file.close();
-
   // Encrypt the message
   auto content = protocol::types::Content("new_message");
-  target.symmetric_key().Encrypt(temp_content_file, *content);
+  target.symmetric_key().Encrypt(text, content);
 
   // Send to server
   auto socket = OpenConnection(protocol::request::SendMessage(
       my_info_->client_id(), target.id(),
       protocol::types::MessageTypes::TextMessage, content));
   protocol::response::MessageSent{socket};  // do nothing...
+  CloseConnection(std::move(socket));
+}
+
+void Session::SendMessageToMany(
+    const std::vector<std::string> &target_usernames,
+    const std::string &text) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  if (!my_info_) throw session::exceptions::UnauthorizedRequest();
+  if (target_usernames.empty()) throw session::exceptions::NoTargets();
+
+  // All the keys are resolved before anything is encrypted
+  std::vector<crypto::symmetric::Key> keys;
+  std::vector<protocol::request::SendMessageBatch::Record> records;
+  keys.reserve(target_usernames.size());
+  records.reserve(target_usernames.size());
+  for (const auto &username : target_usernames) {
+    auto &target = ResolveTarget(username);
+    keys.push_back(target.symmetric_key());
+    records.push_back({target.id(), protocol::types::MessageTypes::TextMessage,
+                       protocol::types::Content("new_message")});
+  }
+
+  // Encrypt the messages, on the crypto pool if it's worth waking it up
+  auto encrypt = [&](std::size_t i) {
+    keys[i].Encrypt(text, records[i].content);
+  };
+  if (text.size() * records.size() < kParallelEncryptSize) {
+    for (std::size_t i = 0; i < records.size(); ++i) encrypt(i);
+  } else {
+    parallel::ForEach(*crypto_pool_, crypto_workers(), records.size(),
+                      encrypt);
+  }
+
+  // Send to server
+  auto count = records.size();
+  auto socket = OpenConnection(protocol::request::SendMessageBatch(
+      my_info_->client_id(), std::move(records)));
+  protocol::response::MessageBatchSent{socket, count};  // do nothing...
+  CloseConnection(std::move(socket));
 }
 
 void Session::SendFile(const std::string &target_username,
                        const std::filesystem::path &file) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
   auto &target = ResolveTarget(target_username);
-  std::ifstream content_file(file);
+  std::ifstream content_file(file, std::ios::binary);
   if (content_file.fail()) throw exceptions::UnknownFilePath(file.string());
 
-  // Encrypt message
-  auto content = protocol::types::Content("new_file");
-  target.symmetric_key().Encrypt(content_file, *content);
+  // The file is encrypted while it's being sent, the size
+  // of the result is known in advance from the size of the file.
+  // A target that can read chunked files, gets the file encrypted
+  // on all the cores.
+  auto key = target.symmetric_key();
+  auto file_size = std::filesystem::file_size(file);
+  auto chunked = target.chunked_files();
+  auto content_size =
+      chunked ? crypto::symmetric::Key::ChunkedCiphertextSize(file_size)
+              : crypto::symmetric::Key::CiphertextSize(file_size);
+  auto encrypt = [&](const protocol::types::ContentWriter &write) {
+    content_file.clear();  // the request may be resent
+    content_file.seekg(0);
+    if (chunked)
+      key.EncryptChunked(content_file, file_size, write, *crypto_pool_,
+                         crypto_workers());
+    else
+      key.Encrypt(content_file, write);
+  };
 
   // Send to server
+  auto type = chunked ? protocol::types::MessageTypes::ChunkedFile
+                      : protocol::types::MessageTypes::File;
+  if (content_size > kPartSize)
+    return SendInParts(target, type, content_size, encrypt);
   auto socket = OpenConnection(protocol::request::SendMessage(
-      my_info_->client_id(), target.id(), protocol::types::MessageTypes::File,
-      content));
+      my_info_->client_id(), target.id(), type, content_size, encrypt));
   protocol::response::MessageSent{socket};  // do nothing...
+  CloseConnection(std::move(socket));
 }
 
 void Session::RequestSymmetricKey(const std::string &target_username) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
   auto &target = ResolveTarget(target_username);
 
-  // This is an empty file, as we don't send,
-  // any additional data in such a request.
-  auto content = protocol::types::Content("empty_file");
+  // Declares what we can read, so the target can pick the formats
+  auto content = protocol::types::Content("capabilities");
+  const char capabilities = protocol::types::Capabilities::ChunkedFiles;
+  content.Write(&capabilities, sizeof(capabilities));
 
   // Send to server
   auto socket = OpenConnection(protocol::request::SendMessage(
       my_info_->client_id(), target.id(),
       protocol::types::MessageTypes::SymmetricKeyRequest, content));
   protocol::response::MessageSent{socket};  // do nothing...
+  CloseConnection(std::move(socket));
 }
 
 void Session::SendSymmetricKey(const std::string &target_username) {
+  std::shared_lock<std::shared_mutex> guard(lock_);
   if (!my_info_) throw session::exceptions::UnauthorizedRequest();
   auto &target = ResolveTarget(target_username);
 
   // Generate&Save the new symmetric key
-  auto dump_key = tempfile::TempFile("symmetric_key");
-  target.set_symmetric_key(crypto::symmetric::Key());
-  target.symmetric_key().Export(dump_key);
+  crypto::symmetric::Key key;
+  target.set_symmetric_key(key);
+  if (key_store_) key_store_->StoreSymmetricKey(target.id(), key);
 
   // Encrypt the key
   auto content = protocol::types::Content("symmetric_key.encrypted");
-  target.public_key().Encrypt(dump_key, *content);
+  target.public_key().Encrypt(key.Export(), content);
 
   // Send to server
   auto socket = OpenConnection(protocol::request::SendMessage(
       my_info_->client_id(), target.id(),
       protocol::types::MessageTypes::SymmetricKey, content));
   protocol::response::MessageSent{socket};  // do nothing...
+  CloseConnection(std::move(socket));
+}
+
+void Session::SendInParts(const types::Client &target,
+                          const protocol::types::MessageType &type,
+                          std::uintmax_t content_size,
+                          const protocol::types::ContentProducer &produce) {
+  constexpr std::uintmax_t max_content_size =
+      std::numeric_limits<protocol::types::ContentSize::DataType>::max();
+  if (content_size > max_content_size)
+    throw protocol::exceptions::ContentSizeLimit(max_content_size,
+                                                 content_size);
+
+  // The content is produced only once, and each part is kept
+  // until the server has it.
+  std::vector<char> part;
+  part.reserve(kPartSize);
+  protocol::types::MessageID transfer_id =
+      static_cast<protocol::types::MessageID::DataType>(0);
+  std::uintmax_t sent = 0;
+  auto send_part = [&]() {
+    auto response = SendPart(protocol::request::SendMessagePart(
+        my_info_->client_id(), target.id(), type,
+        static_cast<protocol::types::ContentSize::DataType>(content_size),
+        transfer_id, static_cast<protocol::types::ContentSize::DataType>(sent),
+        part.data(), part.size()));
+    // The server continues from where the content it has ends
+    if (response.received.value() != sent + part.size())
+      throw std::runtime_error("the server lost the file transfer");
+    transfer_id = response.transfer_id;
+    sent += part.size();
+    part.clear();
+    return response;
+  };
+
+  // An empty part opens the transfer, so the parts of the content, which
+  // may be sent again, always continue it. The opening part itself may
+  // open another transfer when it's sent again (if its response was lost),
+  // the server deletes the abandoned one once it expires.
+  send_part();
+  produce([&](const char *data, std::size_t size) {
+    while (size) {
+      auto chunk = std::min(size, kPartSize - part.size());
+      part.insert(part.end(), data, data + chunk);
+      data += chunk;
+      size -= chunk;
+      if (part.size() == kPartSize) send_part();
+    }
+  });
+  if (sent + part.size() != content_size)
+    throw protocol::exceptions::ContentMismatch();
+  if (!send_part().message_id.value())
+    throw std::runtime_error("the server did not complete the file transfer");
+}
+
+protocol::response::MessagePartReceived Session::SendPart(
+    const protocol::request::SendMessagePart &request) {
+  for (std::size_t attempt = 0;; ++attempt) {
+    try {
+      auto socket = OpenConnection(request);
+      protocol::response::MessagePartReceived response{socket};
+      CloseConnection(std::move(socket));
+      return response;
+    } catch (const protocol::exceptions::GeneralException &) {
+      throw;  // the server refused the part
+    } catch (const std::runtime_error &) {
+      // The connection dropped, and the part may or may not be stored,
+      // the server ignores a part of the content that is sent again.
+      if (attempt == protocol::response::kMaxResumes) throw;
+    }
+  }
 }
 
 boost::asio::ip::tcp::socket Session::OpenConnection(
     const protocol::request::Header &request) {
+  auto send = [&request](boost::asio::ip::tcp::socket &socket,
+                         bool keep_alive) {
+    metrics::Timer timer(metrics::Phase::kSend);
+    timer.add_bytes(request.size());
+    request.send(socket, keep_alive);
+  };
+
   try {
-    static boost::asio::io_context io_context;
-    static boost::asio::ip::tcp::resolver resolver(io_context);
-    static auto server_address =
-        resolver.resolve(server_info_.ip(), server_info_.port());
-
-    boost::asio::ip::tcp::socket socket(io_context);
-    boost::asio::connect(socket, server_address);
-    request.send(socket);  // send the response
+    if (!server_info_.keep_alive()) {
+      auto socket = pool_.Connect();
+      send(socket, /*keep_alive=*/false);  // send the response
+      return socket;
+    }
+
+    bool reused;
+    auto socket = pool_.Acquire(reused);
+    try {
+      send(socket, /*keep_alive=*/true);
+      if (reused) wait_for_response(socket);
+    } catch (const boost::system::system_error &) {
+      if (!reused) throw;
+      // The server closed the idle connection, try again over a new one
+      socket = pool_.Connect();
+      send(socket, /*keep_alive=*/true);
+    }
     return socket;
   } catch (const boost::exception &) {
     throw std::runtime_error("can not initialize a connection with the server");
   }
 }
 
+void Session::CloseConnection(boost::asio::ip::tcp::socket &&socket) {
+  if (server_info_.keep_alive()) pool_.Release(std::move(socket));
+}
+
+void Session::LoadKnownClients() {
+  if (!key_store_) return;
+  std::call_once(known_clients_loaded_, [this]() {
+    key_store_->Load([&](const protocol::types::ClientID &id,
+                         const std::string &username,
+                         const protocol::types::PublicKey *public_key,
+                         const char *symmetric_key, bool chunked_files) {
+      auto *client = clients_.Add(id, username);
+      if (!client) return;
+      if (chunked_files) client->set_chunked_files();
+      try {
+        if (public_key) client->set_public_key(*public_key);
+      } catch (const CryptoPP::Exception &) {
+        // the key is corrupted, it'll have to be polled again
+      }
+      if (symmetric_key) client->set_symmetric_key(symmetric_key);
+    });
+    // The stored clients are the ones up to this version
+    client_list_version_ = key_store_->LoadListVersion();
+  });
+}
+
 types::Client &Session::ResolveTarget(const std::string &username) {
-  try {
-    return *(username_to_client_.at(username));
-  } catch (const std::out_of_range &) {
-    throw session::exceptions::UnknownTarget(username);
-  }
+  metrics::Timer timer(metrics::Phase::kResolve);
+  LoadKnownClients();
+  auto *client = clients_.Find(username);
+  if (!client) throw session::exceptions::UnknownTarget(username);
+  return *client;
 }
 
 crypto::symmetric::Key Session::DecryptSymmetricKey(
-    const tempfile::TempFile &encrypted_key_dump) {
-  tempfile::TempFile decrypted_key_dump(
-      encrypted_key_dump.path().filename().string() + ".decrypted");
+    const std::string &encrypted_key) {
   try {
-    my_info_->private_key().Decrypt(encrypted_key_dump, decrypted_key_dump);
+    std::string raw_key;
+    my_info_->private_key().Decrypt(encrypted_key, raw_key);
+    if (raw_key.size() != crypto::symmetric::kKeySize)
+      throw std::runtime_error("the key has an invalid size");
 
-    std::ifstream dump_key(decrypted_key_dump.path());
-    if (dump_key.fail()) throw std::runtime_error("could not decrypt the key");
-    char raw_key[crypto::symmetric::kKeySize]{0};
-    dump_key.read(raw_key, crypto::symmetric::kKeySize);
-    if (dump_key.gcount() != crypto::symmetric::kKeySize)
-      throw std::runtime_error("key is too long");
-
-    return raw_key;
+    return raw_key.data();
   } catch (const CryptoPP::Exception &) {
     throw std::runtime_error("could not decrypt the key");
   }
 }
 
+types::Message *Session::OpenMessage(
+    const protocol::types::MessageID &id,
+    const protocol::types::MessageType &type, types::Client &sender,
+    const protocol::types::ContentReader &read,
+    const std::function<crypto::symmetric::Key()> &sender_key,
+    const std::function<void(const crypto::symmetric::Key &key)>
+        &received_key) {
+  try {
+    switch (type.value()) {
+      using namespace protocol::types;
+      case MessageTypes::SymmetricKeyRequest: {
+        std::string capabilities;
+        read([&](const char *data, std::size_t size) {
+          if (capabilities.empty()) capabilities.assign(data, size ? 1 : 0);
+        });
+        if (!capabilities.empty() &&
+            (capabilities[0] & Capabilities::ChunkedFiles))
+          LearnChunkedFiles(sender);
+        return new types::SymmetricKeyRequestMessage(sender.username());
+      }
+      case MessageTypes::SymmetricKey: {
+        // A key is a single block of the private key, so it's kept
+        // in memory, anything beyond a block is invalid anyway
+        auto max_size = my_info_->private_key().ciphertext_size() + 1;
+        std::string encrypted_key;
+        read([&](const char *data, std::size_t size) {
+          if (encrypted_key.size() < max_size)
+            encrypted_key.append(
+                data, std::min(size, max_size - encrypted_key.size()));
+        });
+        received_key(DecryptSymmetricKey(encrypted_key));
+        return new types::ReceivedSymmetricKeyMessage(sender.username());
+      }
+      case MessageTypes::File:
+      case MessageTypes::ChunkedFile: {
+        auto key = sender_key();
+        // The plaintext is only kept once all of it was verified,
+        // a partial one is deleted along with the message.
+        auto *res_msg = new types::FileMessage(
+            sender.username(),
+            new tempfile::TempFile("message_" + std::to_string(id.value()) +
+                                   ".decrypted"));
+        try {
+          if (type.value() == MessageTypes::ChunkedFile) {
+            key.DecryptChunked(read, *res_msg->dump_file_, *crypto_pool_,
+                               crypto_workers());
+            LearnChunkedFiles(sender);  // it can surely read what it sends
+          } else {
+            key.Decrypt(read, *res_msg->dump_file_);
+          }
+        } catch (...) {
+          delete res_msg;
+          throw;
+        }
+        res_msg->dump_file_->Keep();
+        return res_msg;
+      }
+      case MessageTypes::TextMessage: {
+        std::string text;
+        sender_key().Decrypt(read, text);
+        return new types::TextMessage(sender.username(), text);
+      }
+      default:
+        // We can't decrypt it...
+        return new types::EncryptedMessage(sender.username());
+    }
+  } catch (const CryptoPP::Exception &) {
+    return new types::EncryptedMessage(sender.username());
+  } catch (const exceptions::MissingKey &) {
+    return new types::EncryptedMessage(sender.username());
+  } catch (const std::runtime_error &e) {
+    return new types::ErrorMessage(sender.username(), e.what());
+  }
+}
+
+void Session::OpenMessagesInline(
+    protocol::response::PendingMessages &response,
+    const protocol::types::MessageID &first,
+    const std::function<void(const types::Message &message)> &callback) {
+  // The contents are decrypted while they're read from the socket, straight
+  // into their final destination, so they're never stored encrypted.
+  response.StreamMessages([&](protocol::response::Message &message,
+                              const protocol::types::ContentReader &read) {
+    if (message.id.value() < first.value()) return;
+    auto *sender = clients_.Find(message.sender_id);
+    if (!sender) {
+      callback(
+          types::ErrorMessage("Unknown", "Can not resolve the sender id."));
+      return;
+    }
+    auto *opened = OpenMessage(
+        message.id, message.type, *sender, read,
+        [&]() { return sender->symmetric_key(); },
+        [&](const crypto::symmetric::Key &key) {
+          sender->set_symmetric_key(key);
+          if (key_store_) key_store_->StoreSymmetricKey(sender->id(), key);
+        });
+    try {
+      callback(*opened);
+    } catch (...) {
+      delete opened;
+      throw;
+    }
+    delete opened;
+  });
+}
+
+void Session::OpenMessagesInParallel(
+    protocol::response::PendingMessages &response,
+    const protocol::types::MessageID &first,
+    const std::function<void(const types::Message &message)> &callback) {
+  // A message that is being decrypted, along with the key it holds
+  struct Opened {
+    types::Message *message;
+    crypto::symmetric::Key *received_key;
+    types::Client *sender;
+  };
+  using KeyFuture = std::shared_future<crypto::symmetric::Key>;
+
+  // The messages that were downloaded, but not passed to the callback yet.
+  // Their amount is bounded, so the download waits for the workers,
+  // instead of filling the memory (or the disk) with encrypted contents.
+  std::deque<std::future<Opened>> opening;
+  auto max_opening = server_info_.decrypt_workers() * kOpeningPerWorker;
+
+  // Passes the oldest message to the callback, and saves the key it holds.
+  // The keys are saved in order, so the latest key is the one that stays.
+  auto deliver = [&]() {
+    auto opened = opening.front().get();
+    opening.pop_front();
+    if (opened.received_key) {
+      opened.sender->set_symmetric_key(*opened.received_key);
+      if (key_store_)
+        key_store_->StoreSymmetricKey(opened.sender->id(),
+                                      *opened.received_key);
+      delete opened.received_key;
+    }
+    try {
+      callback(*opened.message);
+    } catch (...) {
+      delete opened.message;
+      throw;
+    }
+    delete opened.message;
+  };
+
+  // The key each sender's next message is encrypted with. A message
+  // that holds a new key replaces it with a key that is still being
+  // decrypted, so the messages that follow wait for it.
+  std::map<protocol::types::ClientID, KeyFuture> sender_keys;
+  auto sender_key = [&](types::Client &sender) -> KeyFuture & {
+    auto found = sender_keys.find(sender.id());
+    if (found != sender_keys.end()) return found->second;
+
+    std::promise<crypto::symmetric::Key> current;
+    try {
+      current.set_value(sender.symmetric_key());
+    } catch (const exceptions::MissingKey &) {
+      current.set_exception(std::current_exception());
+    }
+    return sender_keys[sender.id()] = current.get_future().share();
+  };
+
+  try {
+    response.StreamMessages([&](protocol::response::Message &message,
+                                const protocol::types::ContentReader &read) {
+      if (message.id.value() < first.value()) return;
+      auto *sender = clients_.Find(message.sender_id);
+      if (!sender) {
+        std::promise<Opened> unknown;
+        unknown.set_value(
+            {new types::ErrorMessage("Unknown",
+                                     "Can not resolve the sender id."),
+             nullptr, nullptr});
+        opening.push_back(unknown.get_future());
+      } else {
+        // Owned by the worker, which releases it as soon as
+        // the message was opened
+        auto *content = new protocol::types::Content(
+            "message_" + std::to_string(message.id.value()));
+        try {
+          read([&](const char *data, std::size_t size) {
+            content->Write(data, size);
+          });
+        } catch (...) {
+          delete content;
+          throw;
+        }
+
+        KeyFuture key = sender_key(*sender);
+        std::promise<crypto::symmetric::Key> *next_key = nullptr;
+        if (message.type.value() ==
+            protocol::types::MessageTypes::SymmetricKey) {
+          next_key = new std::promise<crypto::symmetric::Key>;
+          sender_keys[sender->id()] = next_key->get_future().share();
+        }
+
+        auto id = message.id;
+        auto type = message.type;
+        auto *task = new std::packaged_task<Opened()>([=]() {
+          Opened opened{nullptr, nullptr, sender};
+          try {
+            opened.message = OpenMessage(
+                id, type, *sender,
+                [&](const protocol::types::ContentWriter &write) {
+                  content->Read(write);
+                },
+                [&]() { return key.get(); },
+                [&](const crypto::symmetric::Key &received) {
+                  opened.received_key = new crypto::symmetric::Key(received);
+                });
+          } catch (...) {
+            delete content;
+            // The messages that wait for the key it holds fail the same
+            // way, as they would have without the workers, instead of
+            // on a broken promise.
+            if (next_key) {
+              next_key->set_exception(std::current_exception());
+              delete next_key;
+            }
+            throw;
+          }
+          delete content;
+
+          if (next_key) {
+            if (opened.received_key)
+              next_key->set_value(*opened.received_key);
+            else  // the key wasn't replaced
+              try {
+                next_key->set_value(key.get());
+              } catch (const exceptions::MissingKey &) {
+                next_key->set_exception(std::current_exception());
+              }
+            delete next_key;
+          }
+          return opened;
+        });
+        opening.push_back(task->get_future());
+        boost::asio::post(*decrypt_pool_, [task]() {
+          (*task)();
+          delete task;
+        });
+      }
+
+      // Pass whatever is ready, and wait if too many are still decrypted
+      while (!opening.empty() &&
+             (opening.size() >= max_opening ||
+              opening.front().wait_for(std::chrono::seconds(0)) ==
+                  std::future_status::ready))
+        deliver();
+    });
+    while (!opening.empty()) deliver();
+  } catch (...) {
+    // Wait for the workers, they still use the messages
+    for (auto &pending : opening) {
+      try {
+        auto opened = pending.get();
+        delete opened.message;
+        delete opened.received_key;
+      } catch (...) {
+      }
+    }
+    throw;
+  }
+}
+
+void Session::LearnChunkedFiles(types::Client &client) {
+  if (client.chunked_files()) return;
+  client.set_chunked_files();
+  if (key_store_) key_store_->StoreChunkedFiles(client.id());
+}
+
+void Session::RunSubscription(
+    std::function<void(const types::Message &message)> callback) {
+  auto reconnect_delay = kFirstReconnectDelay;
+  while (subscribed_) {
+    try {
+      ReceivePushedMessages(callback, reconnect_delay);
+      return;
+    } catch (...) {
+      // The connection dropped, or the server is unavailable,
+      // the messages we didn't confirm will be pushed again.
+    }
+    std::unique_lock<std::mutex> guard(subscription_lock_);
+    subscription_stopped_.wait_for(guard, reconnect_delay,
+                                   [this]() { return !subscribed_; });
+    reconnect_delay = std::min(reconnect_delay * 2, kMaxReconnectDelay);
+  }
+}
+
+void Session::ReceivePushedMessages(
+    const std::function<void(const types::Message &message)> &callback,
+    std::chrono::seconds &reconnect_delay) {
+  // The subscription holds a connection of its own, the server never
+  // returns it to be reused.
+  protocol::types::ClientID my_id;
+  protocol::types::MessageID from;
+  {
+    std::shared_lock<std::shared_mutex> guard(lock_);
+    std::lock_guard<std::mutex> retrieving(retrieve_lock_);
+    my_id = my_info_->client_id();
+    from = next_message_;
+  }
+  auto socket = pool_.Connect();
+  protocol::request::SubscribePendingMessages(my_id, from).send(socket);
+
+  while (true) {
+    while (!wait_for_data(socket, kSubscriptionPollMilliseconds))
+      if (!subscribed_) return;
+
+    auto batch = protocol::response::PendingMessages(std::move(socket));
+    protocol::types::MessageID next;
+    {
+      std::shared_lock<std::shared_mutex> guard(lock_);
+      LoadKnownClients();
+      std::lock_guard<std::mutex> retrieving(retrieve_lock_);
+      // The messages we retrieved in the meantime are skipped
+      if (batch) {
+        if (decrypt_pool_)
+          OpenMessagesInParallel(batch, next_message_, callback);
+        else
+          OpenMessagesInline(batch, next_message_, callback);
+        next_message_ = std::max(next_message_.value(),
+                                 batch.last_message_id().value() + 1);
+      }
+      next = next_message_;
+    }
+    socket = batch.ReleaseSocket();
+    protocol::request::SubscriptionAcknowledgment(next).send(socket);
+    reconnect_delay = kFirstReconnectDelay;
+  }
+}
+
 Session::~Session() {
+  Unsubscribe();
+  if (decrypt_pool_) decrypt_pool_->join();
+  delete decrypt_pool_;
+  crypto_pool_->join();  // after the decrypt workers, which use it
+  delete crypto_pool_;
   delete my_info_;
-
-  // the maps are sharing their pointers.
-  for (auto &[username, client_ptr] : username_to_client_) delete client_ptr;
+  delete key_store_;
 }
 
 }  // namespace session
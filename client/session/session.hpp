@@ -1,10 +1,16 @@
 #ifndef CLIENT_SESSION_H
 #define CLIENT_SESSION_H
 
+#include <atomic>
 #include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
-#include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "../config.hpp"
 #include "../crypto/asymmetric.hpp"
@@ -12,6 +18,9 @@
 #include "../protocol/request.hpp"
 #include "../protocol/response.hpp"
 #include "../protocol/types.hpp"
+#include "connection_pool.hpp"
+#include "directory.hpp"
+#include "key_store.hpp"
 #include "types.hpp"
 
 namespace messageu {
@@ -34,18 +43,26 @@ class Session {
   // Any function that requires a target username will try to resolve the
   // target by its username, and throws session::exceptions::UnknownTarget
   // if it fails to do so.
+  //
+  // The session can be shared between threads, requests run concurrently
+  // unless they modify the client tables (Register, UpdateClientList).
+  // A callback should not make requests through the same session.
  public:
-  Session(const config::ServerInfo &server_info) : server_info_(server_info) {}
+  Session(const config::ServerInfo &server_info);
 
   // Will try to read the info from the given info file,
   // but will not complain if it fails
+  //
+  // The clients we know, and their keys, are kept in a store next to
+  // the info file, and loaded once they're first needed.
   Session(const config::ServerInfo &server_info,
           std::filesystem::path info_file);
 
   // Registers the client to the server
   // one should make sure to register before using any other function.
   //
-  // Saves the client info to 'info_file'
+  // Saves the client info to 'info_file', and starts
+  // a new store of keys next to it.
   //
   // Throws:
   //  session::exceptions::AlreadyRegistered: you're already
@@ -57,6 +74,10 @@ class Session {
   // Polls the client list from the server.
   // For each client calls the callback with the client username.
   //
+  // Only the clients that changed since the last update are polled,
+  // and merged into the known clients, so the keys we already have
+  // for them are kept.
+  //
   // You can use a client username returned from this function
   // with any of the other functions.
   void UpdateClientList(
@@ -74,9 +95,45 @@ class Session {
   // When you receive a symmetric key, the session takes care of saving it,
   // even if you never requested it. However, when you get a request for key,
   // you have to decide if you actually want to send it.
+  //
+  // If the server info asks for decrypt workers, the messages are decrypted
+  // on them while the following messages are downloaded. Either way the
+  // callback is called from the calling thread, in the order the messages
+  // were sent.
+  //
+  // If the connection drops in the middle, the download continues over
+  // a new connection from where it stopped, a few times at most.
+  // The server keeps a message until we confirm we received it, so a message
+  // may be received again if we never got to confirm it (like after a crash).
   void RetrievePendingMessages(
       std::function<void(const types::Message &message)> callback);
 
+  // [Authorized]
+  // Subscribes to the pending messages: the server pushes each message over
+  // a connection of its own as soon as it arrives, and the messages are
+  // passed to the callback on a background thread, in the order they were
+  // sent. They're decrypted just like RetrievePendingMessages decrypts
+  // them, and the two can be mixed, each message is only passed once.
+  //
+  // If the connection drops, the subscription reconnects in the
+  // background, and continues from the first message we didn't receive.
+  // A previous subscription is stopped first.
+  //
+  // A batch is confirmed once the callback went through all of its
+  // messages, so the callback should hand them off rather than block on
+  // them, the server drops a subscription whose batch isn't confirmed in
+  // time (and we reconnect).
+  //
+  // Subscribe and Unsubscribe should not be called concurrently.
+  void Subscribe(std::function<void(const types::Message &message)> callback);
+
+  // Stops the subscription, if there is one. Once it returns,
+  // the callback of the subscription is no longer called.
+  void Unsubscribe();
+
+  // Whether there is a subscription to the pending messages
+  bool subscribed() const { return subscribed_; }
+
   // [Authorized]
   // Sends a text message
   //
@@ -85,9 +142,26 @@ class Session {
   //        for the target
   void SendMessage(const std::string &target_username, const std::string &text);
 
+  // [Authorized]
+  // Sends the same text message to several targets, in a single request.
+  // The text is encrypted with the key of each target, on the crypto pool
+  // once there is enough of it.
+  // Either all of the messages are sent, or none of them.
+  //
+  // Throws:
+  //    session::exceptions::NoTargets: the list of targets is empty
+  //    session::exceptions::MissingKey: does not have a symmetric key
+  //        for one of the targets
+  void SendMessageToMany(const std::vector<std::string> &target_usernames,
+                         const std::string &text);
+
   // [Authorized]
   // Sends a file
   //
+  // A large file is sent in parts, and if the connection drops the part
+  // that was being sent is sent again over a new connection, a few times
+  // at most, so the parts that were already sent are not repeated.
+  //
   // Throws:
   //    session::exceptions::MissingKey: does not have a symmetric key
   //        for the target
@@ -117,9 +191,35 @@ class Session {
  private:
   // Internal function that handles all the boiler-plate related to
   // initializing a new connection with the server
+  //
+  // When keep-alive is enabled, it reuses an idle connection if possible,
+  // and reconnects if the server already closed it. A reused connection
+  // is only returned once the response started to arrive over it, as it
+  // may only fail then.
   boost::asio::ip::tcp::socket OpenConnection(
       const protocol::request::Header &request);
 
+  // Internal function that marks the end of a request,
+  // should only be called once the whole response has been read.
+  // The connection is kept for future requests if keep-alive is enabled.
+  void CloseConnection(boost::asio::ip::tcp::socket &&socket);
+
+  // Internal function that sends a produced content in parts, as a single
+  // message to the target.
+  void SendInParts(const types::Client &target,
+                   const protocol::types::MessageType &type,
+                   std::uintmax_t content_size,
+                   const protocol::types::ContentProducer &produce);
+
+  // Internal function that sends a part of a content, and sends it again
+  // over a new connection if the connection drops.
+  protocol::response::MessagePartReceived SendPart(
+      const protocol::request::SendMessagePart &request);
+
+  // Internal function that loads the stored clients into the tables,
+  // only once, the first time the tables are needed.
+  void LoadKnownClients();
+
   // Internal function that tries to resolve a client by its username,
   // and throws session::exceptions::UnknownTarget if it could not
   // find the target.
@@ -134,17 +234,96 @@ class Session {
   // using our own private key
   //
   // Throws std::runtime_error if fails to decrypt the key
-  crypto::symmetric::Key DecryptSymmetricKey(
-      const tempfile::TempFile &encrypted_key_dump);
+  crypto::symmetric::Key DecryptSymmetricKey(const std::string &encrypted_key);
+
+  // Internal function that decrypts a single pending message, and wraps it
+  // in a new message class, that the caller has to delete.
+  //
+  // 'sender_key' returns the key the message was encrypted with,
+  // and a symmetric key the message holds is passed to 'received_key',
+  // as a failure to decrypt a message is reported as a message.
+  types::Message *OpenMessage(
+      const protocol::types::MessageID &id,
+      const protocol::types::MessageType &type, types::Client &sender,
+      const protocol::types::ContentReader &read,
+      const std::function<crypto::symmetric::Key()> &sender_key,
+      const std::function<void(const crypto::symmetric::Key &key)>
+          &received_key);
+
+  // Internal function that marks a client as one that can read
+  // chunked files, and stores it.
+  void LearnChunkedFiles(types::Client &client);
+
+  // Internal function that decrypts the pending messages while they're
+  // downloaded, and passes them to the callback one by one.
+  // The messages before 'first' were already passed, and are skipped.
+  void OpenMessagesInline(
+      protocol::response::PendingMessages &response,
+      const protocol::types::MessageID &first,
+      const std::function<void(const types::Message &message)> &callback);
+
+  // Internal function that downloads the pending messages, and passes
+  // them to the decrypt workers, while the decrypted messages are passed
+  // to the callback in order.
+  // The messages before 'first' were already passed, and are skipped.
+  void OpenMessagesInParallel(
+      protocol::response::PendingMessages &response,
+      const protocol::types::MessageID &first,
+      const std::function<void(const types::Message &message)> &callback);
+
+  // Internal function that runs on the subscription thread, it keeps
+  // the subscription going until Unsubscribe stops it.
+  void RunSubscription(
+      std::function<void(const types::Message &message)> callback);
+
+  // Internal function that subscribes over a new connection, and passes
+  // the batches it pushes to the callback until the connection drops,
+  // or until Unsubscribe stops it. Every batch resets the delay
+  // before the next attempt to reconnect.
+  void ReceivePushedMessages(
+      const std::function<void(const types::Message &message)> &callback,
+      std::chrono::seconds &reconnect_delay);
 
   config::ServerInfo server_info_;
+  ConnectionPool pool_;
+
+  // Decrypts pending messages, null if there are no decrypt workers
+  boost::asio::thread_pool *decrypt_pool_ = nullptr;
+
+  // Encrypts and decrypts the chunks of large files, shared by all the
+  // requests and the decrypt workers, so their threads are never more
+  // than the cores.
+  boost::asio::thread_pool *crypto_pool_ = nullptr;
+
+  // Guards my_info_ and the client tables
+  std::shared_mutex lock_;
   config::MyInfo *my_info_ = nullptr;
 
-  // maps ids/username [they're unique] to clients.
-  // the idea to use map both ways is to take advantage of the hash_table,
-  // and avoid wasteful searches.
-  std::map<std::string, types::Client *> username_to_client_;
-  std::map<protocol::types::ClientID, types::Client *> id_to_client_;
+  // The clients we know, by their id and by their username [both unique]
+  ClientDirectory clients_;
+
+  // Keeps the tables on disk, null if there is no info file
+  KeyStore *key_store_ = nullptr;
+  std::once_flag known_clients_loaded_;
+
+  // Serializes the retrieval of pending messages, and holds the id of the
+  // first message we didn't receive yet, the server deletes the ones
+  // before it once we ask for it.
+  std::mutex retrieve_lock_;
+  protocol::types::MessageID next_message_ =
+      static_cast<protocol::types::MessageID::DataType>(0);
+
+  // The thread the subscription runs on, and the flag that stops it.
+  // Unsubscribe wakes it up through the condition if it waits to reconnect.
+  std::thread subscription_;
+  std::atomic<bool> subscribed_{false};
+  std::mutex subscription_lock_;
+  std::condition_variable subscription_stopped_;
+
+  // The version of the client list we hold, kept in the store along
+  // with the clients, guarded by lock_
+  protocol::types::Timestamp client_list_version_ =
+      static_cast<protocol::types::Timestamp::DataType>(0);
 };
 
 }  // namespace session
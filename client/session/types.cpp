@@ -1,8 +1,5 @@
 #include "types.hpp"
 
-#include <fstream>
-
-#include "../protocol/types.hpp"
 #include "exceptions.hpp"
 
 namespace messageu {
@@ -30,16 +27,7 @@ FileMessage::FileMessage(FileMessage &other)
   other.dump_file_ = nullptr;
 }
 
-void TextMessage::Display(std::ostream &ostream) const {
-  std::ifstream content_file(dump_file_->path());
-
-  while (content_file) {
-    char data[protocol::types::kBlockSize]{0};
-    content_file.read(data, protocol::types::kBlockSize);
-    if (content_file.gcount())  // write as much as you actually read
-      ostream.write(data, content_file.gcount());
-  }
-}
+void TextMessage::Display(std::ostream &ostream) const { ostream << text_; }
 
 void FileMessage::Display(std::ostream &ostream) const {
   ostream << "[File] " << dump_file_->path().string();
@@ -53,24 +41,30 @@ void ErrorMessage::Display(std::ostream &ostream) const {
   ostream << "[ERROR] " << reason_;
 }
 
-const crypto::symmetric::Key &Client::symmetric_key() const {
+crypto::symmetric::Key Client::symmetric_key() const {
+  std::lock_guard<std::mutex> guard(keys_lock_);
   if (!symmetric_key_) throw exceptions::MissingKey("symmetric");
   return *symmetric_key_;
 }
 
-const crypto::asymmetric::PublicKey &Client::public_key() const {
+crypto::asymmetric::PublicKey Client::public_key() const {
+  std::lock_guard<std::mutex> guard(keys_lock_);
   if (!public_key_) throw exceptions::MissingKey("public");
   return *public_key_;
 }
 
 void Client::set_symmetric_key(const crypto::symmetric::Key &key) {
+  auto *new_key = new crypto::symmetric::Key(key);
+  std::lock_guard<std::mutex> guard(keys_lock_);
   if (symmetric_key_) delete symmetric_key_;
-  symmetric_key_ = new crypto::symmetric::Key(key);
+  symmetric_key_ = new_key;
 }
 
 void Client::set_public_key(const crypto::asymmetric::PublicKey &key) {
+  auto *new_key = new crypto::asymmetric::PublicKey(key);
+  std::lock_guard<std::mutex> guard(keys_lock_);
   if (public_key_) delete public_key_;
-  public_key_ = new crypto::asymmetric::PublicKey(key);
+  public_key_ = new_key;
 }
 
 Client::~Client() {
@@ -1,7 +1,9 @@
 #ifndef CLIENT_SESSION_TYPES_H
 #define CLIENT_SESSION_TYPES_H
 
+#include <atomic>
 #include <filesystem>
+#include <mutex>
 #include <ostream>
 
 #include "../crypto/asymmetric.hpp"
@@ -74,15 +76,16 @@ class FileMessage : public Message {
   tempfile::TempFile *dump_file_;
 };
 
-class TextMessage : public FileMessage {
+class TextMessage : public Message {
   friend Session;
 
  protected:
-  // Check FileMessage constructor for more info
-  TextMessage(const std::string &sender_name, tempfile::TempFile *dump_file_)
-      : FileMessage(sender_name, dump_file_) {}
+  TextMessage(const std::string &sender_name, const std::string &text)
+      : Message(sender_name), text_(text) {}
 
   void Display(std::ostream &ostream) const;
+
+  std::string text_;
 };
 
 // When the session can't decrypt the message.
@@ -110,6 +113,9 @@ class ErrorMessage : public Message {
 
 // Can't use a struct because the keys are pointers
 // and we aren't allowed to use smart-pointers.
+//
+// The keys may be replaced while other threads use them,
+// so they're handed out as copies.
 class Client {
  public:
   Client(const protocol::types::ClientID &id, const std::string &username)
@@ -119,17 +125,21 @@ class Client {
   const std::string &username() const { return username_; };
 
   // Throws session::exceptions::MissingKey if there is no symmetric_key
-  const crypto::symmetric::Key &symmetric_key() const;
+  crypto::symmetric::Key symmetric_key() const;
 
   // Overwrites the old one if exists
   void set_symmetric_key(const crypto::symmetric::Key &key);
 
   // Throws session::exceptions::MissingKey if there is no public_key
-  const crypto::asymmetric::PublicKey &public_key() const;
+  crypto::asymmetric::PublicKey public_key() const;
 
   // Overwrites the old one if exists
   void set_public_key(const crypto::asymmetric::PublicKey &key);
 
+  // Whether the client declared it can read chunked files
+  bool chunked_files() const { return chunked_files_; }
+  void set_chunked_files() { chunked_files_ = true; }
+
   ~Client();
 
   // symmetric_key is unshareble
@@ -138,8 +148,11 @@ class Client {
  private:
   protocol::types::ClientID id_;
   std::string username_;
+
+  mutable std::mutex keys_lock_;  // guards the keys
   crypto::symmetric::Key *symmetric_key_ = nullptr;
   crypto::asymmetric::PublicKey *public_key_ = nullptr;
+  std::atomic<bool> chunked_files_{false};
 };
 
 }  // namespace types
@@ -6,8 +6,11 @@
 #include <cstddef>
 #include <fstream>
 #include <iosfwd>
+#include <mutex>
 #include <random>
 
+#include "metrics.hpp"
+
 namespace messageu {
 
 namespace {
@@ -21,7 +24,9 @@ std::string random_name(std::size_t size) {
                                                             chars.size() - 1);
   static std::random_device rd;
   static std::default_random_engine rng_engine(rd());
+  static std::mutex rng_lock;  // tempfiles may be created by many threads
 
+  std::lock_guard<std::mutex> guard(rng_lock);
   std::string filename;
   for (size_t i = 0; i < size; ++i)
     filename.push_back(chars[index_dist(rng_engine)]);
@@ -33,6 +38,7 @@ std::string random_name(std::size_t size) {
 namespace tempfile {
 TempFile::TempFile(const std::string &name, bool auto_delete)
     : auto_delete_(auto_delete) {
+  metrics::Timer timer(metrics::Phase::kTempfileCreate);
   static auto temp_subsystem = std::filesystem::temp_directory_path() /
                                kTempFolderName / random_name(kSystemRandomSize);
   std::filesystem::create_directories(temp_subsystem);
@@ -43,6 +49,7 @@ TempFile::TempFile(const std::string &name, bool auto_delete)
 }
 
 TempFile::~TempFile() {
+  metrics::Timer timer(metrics::Phase::kTempfileDelete);
   try {
     if (!size() || auto_delete_) std::remove(path_.string().c_str());
   } catch (const std::exception &) {
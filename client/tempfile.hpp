@@ -34,6 +34,9 @@ class TempFile {
   // does nothing will happen if the file got deleted already.
   ~TempFile();
 
+  // Turns auto_delete off, so the file is kept once it's complete.
+  void Keep() { auto_delete_ = false; }
+
   const std::filesystem::path &path() const { return path_; }
   const std::uintmax_t size() const {
     return std::filesystem::file_size(path_);
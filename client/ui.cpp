@@ -1,16 +1,25 @@
 #include "ui.hpp"
 
 #include <limits>
+#include <stdexcept>
 
 namespace messageu {
 namespace ui {
 
 void UI::RegisterCmd(std::size_t trigger, const std::string& title,
-                     std::function<void(std::ostream& output)> callback) {
-  triggers_[trigger] = Command{.title = title, .callback = callback};
+                     std::function<void(std::ostream& output)> callback,
+                     std::size_t fields) {
+  triggers_[trigger] =
+      Command{.title = title, .callback = callback, .fields = fields};
 }
 
 std::string UI::ReadLine(const std::string& prompt) {
+  if (batch_) {
+    if (next_field_ == fields_.size())
+      throw std::invalid_argument("missing a field for \"" + prompt + "\"");
+    return fields_[next_field_++];
+  }
+
   std::string line;
   std::cout << prompt;
   // Read until you receieve a non-empty line
@@ -29,10 +38,14 @@ void UI::Run(std::size_t exit_trigger) {
 
   while (true) {
     // Display the menu
-    std::cout << "\n\n" << title_ << "\n\n";
-    for (const auto& [trigger, command] : triggers_)
-      std::cout << trigger << ") " << command.title << "\n";
-    std::cout << exit_trigger << ") Exit client\nYour choice: ";
+    {
+      std::lock_guard<std::mutex> guard(output_lock_);
+      std::cout << "\n\n" << title_ << "\n\n";
+      for (const auto& [trigger, command] : triggers_)
+        std::cout << trigger << ") " << command.title << "\n";
+      std::cout << exit_trigger << ") Exit client\nYour choice: ";
+      std::cout.flush();
+    }
 
     // Parse request
     std::size_t trigger;
@@ -40,6 +53,7 @@ void UI::Run(std::size_t exit_trigger) {
     if (std::cin.bad() || std::cin.eof()) {
       return;
     } else if (std::cin.fail()) {
+      std::lock_guard<std::mutex> guard(output_lock_);
       std::cout << "Unknown cmd!\n" << std::endl;
       // Ignore the whole line
       std::cin.clear();
@@ -49,13 +63,93 @@ void UI::Run(std::size_t exit_trigger) {
     } else {
       try {
         auto cmd = triggers_.at(trigger);
-        cmd.callback(std::cout);
+        RunCmd([&]() { cmd.callback(std::cout); });
       } catch (const std::out_of_range&) {
+        std::lock_guard<std::mutex> guard(output_lock_);
         std::cout << "Unknown cmd!" << std::endl;
       }
     }
   }
 }
 
+std::size_t UI::RunBatch(std::istream& input, std::size_t exit_trigger) {
+  batch_ = true;
+  std::size_t failures = 0;
+  std::size_t line_number = 0;
+  std::string line;
+  while (std::getline(input, line)) {
+    ++line_number;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.find_first_not_of(" \t") == std::string::npos || line[0] == '#')
+      continue;
+
+    // Split the line into its fields
+    fields_.clear();
+    std::size_t start = 0;
+    for (auto end = line.find('\t'); end != std::string::npos;
+         start = end + 1, end = line.find('\t', start))
+      fields_.push_back(line.substr(start, end - start));
+    fields_.push_back(line.substr(start));
+    next_field_ = 1;
+
+    try {
+      const auto& name = fields_[0];
+      auto command = triggers_.end();
+      if (!name.empty() && name.size() < 10 &&
+          name.find_first_not_of("0123456789") == std::string::npos) {
+        std::size_t trigger = std::stoul(name);
+        if (trigger == exit_trigger) break;
+        command = triggers_.find(trigger);
+      }
+      if (command == triggers_.end())
+        throw std::invalid_argument("unknown cmd \"" + name + "\"");
+      // The extra fields are rejected before the cmd has any effect
+      if (fields_.size() - 1 > command->second.fields)
+        throw std::invalid_argument("too many fields");
+      RunCmd([&]() {
+        command->second.callback(std::cout);
+        std::cout << '\n';
+      });
+    } catch (const std::exception& e) {
+      std::cerr << "line " << line_number << ": " << e.what() << std::endl;
+      ++failures;
+    }
+  }
+  std::cout.flush();
+  batch_ = false;
+  return failures;
+}
+
+void UI::Notify(const std::string& text) {
+  std::lock_guard<std::mutex> guard(output_lock_);
+  if (running_cmd_) {
+    notifications_.push_back(text);
+    return;
+  }
+  std::cout << text << std::flush;
+}
+
+void UI::RunCmd(const std::function<void()>& cmd) {
+  {
+    std::lock_guard<std::mutex> guard(output_lock_);
+    running_cmd_ = true;
+  }
+  try {
+    cmd();
+  } catch (...) {
+    FinishCmd();
+    throw;
+  }
+  FinishCmd();
+}
+
+void UI::FinishCmd() {
+  std::lock_guard<std::mutex> guard(output_lock_);
+  running_cmd_ = false;
+  for (const auto& text : notifications_) std::cout << text;
+  notifications_.clear();
+  std::cout.flush();
+}
+
 }  // namespace ui
 }  // namespace messageu
\ No newline at end of file
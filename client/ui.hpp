@@ -8,7 +8,9 @@
 #include <iosfwd>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace messageu {
 namespace ui {
@@ -16,6 +18,7 @@ namespace ui {
 struct Command {
   std::string title;
   std::function<void(std::ostream& output)> callback;
+  std::size_t fields;
 };
 
 class UI {
@@ -35,10 +38,17 @@ class UI {
   //    the UI will call the callback function every time the user
   //    triggers this cmd. the function gets an output stream to
   //    which it can display content to the user.
+  //  fields:
+  //    the amount of lines the callback reads with ReadLine, a batch
+  //    line with more fields than that is rejected before it runs.
   void RegisterCmd(std::size_t trigger, const std::string& title,
-                   std::function<void(std::ostream& output)> callback);
+                   std::function<void(std::ostream& output)> callback,
+                   std::size_t fields = 0);
 
   // Reads a line from the user
+  //
+  // While a batch runs, returns the next field of the current batch line
+  // instead, and throws std::invalid_argument if there are none left.
   std::string ReadLine(const std::string& prompt);
 
   // Runs the UI in a loop.
@@ -49,9 +59,48 @@ class UI {
   //    be aware that it'll overwrite existing key.
   void Run(std::size_t exit_trigger);
 
+  // Runs the cmds of a batch, without the menu, and without prompts.
+  //
+  // Each line holds a trigger, followed by the answers to the prompts of
+  // its cmd, in order, all separated by tabs. A line with fields its cmd
+  // doesn't read fails without running it. Empty lines, and lines that
+  // start with '#', are skipped. The output of each cmd is followed by a
+  // new line, and the errors are reported to std::cerr with their line.
+  //
+  // A failed line doesn't stop the batch, the batch stops at the end of
+  // the input, or at the exit trigger.
+  //
+  // Returns the amount of lines that failed.
+  std::size_t RunBatch(std::istream& input, std::size_t exit_trigger);
+
+  // Displays a text from another thread, like a message that was pushed.
+  //
+  // The text is displayed right away, unless a cmd is running, in which
+  // case it's displayed once the cmd is done, so it never interleaves with
+  // the output of the UI, and never waits for a cmd.
+  void Notify(const std::string& text);
+
  private:
+  // Internal function that runs a cmd, while the notifications wait
+  void RunCmd(const std::function<void()>& cmd);
+
+  // Internal function that displays the notifications that waited
+  // for the cmd that is done
+  void FinishCmd();
+
   std::string title_;
   std::map<std::size_t, Command> triggers_;
+
+  // Guards the output, against the notifications of other threads,
+  // and the notifications that wait for the running cmd
+  std::mutex output_lock_;
+  bool running_cmd_ = false;
+  std::vector<std::string> notifications_;
+
+  // The fields of the current batch line, and the next one to read
+  bool batch_ = false;
+  std::vector<std::string> fields_;
+  std::size_t next_field_ = 0;
 };
 
 }  // namespace ui
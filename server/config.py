@@ -13,12 +13,48 @@ PORT_LOCATION = 'myport.info'
 DATABASE_NAME = 'server.db'
 LOGS_RELATIVE_PATH = 'logs'
 
-# The size the maximum chunk size we use to [read from / write to] the network
-DATA_CHUNK_SIZE = 1024
+# The size the maximum chunk size we use to [read from / write to] the network,
+# large chunks mean fewer system calls on fast links
+DATA_CHUNK_SIZE = 256 * 1024
+
+# The maximum size of a single part of a message that is sent in parts
+MAX_MESSAGE_PART_SIZE = 16 * 1024 * 1024
+
+# Where the contents of large messages are kept, outside of the database,
+# and the size of a content (in bytes) from which it's kept there
+BLOB_STORE_PATH = 'blobs'
+BLOB_THRESHOLD = 64 * 1024
 
 # The amount of rows in each chunk of results of a database query
 DB_CHUNK_SIZE = 10
 
+# The amount of seconds a database connection waits for another one
+# that is writing, before it gives up
+DB_BUSY_TIMEOUT = 30
+
+# The amount of seconds between the updates of the last time the clients
+# were seen, the clients that were seen in between are updated at once
+LAST_SEEN_INTERVAL = 1
+
+# The amount of seconds a message that is sent in parts may take, from the
+# time it was opened, after which it's deleted along with its parts, whether
+# it was abandoned or completed, and the amount of seconds between the checks
+TRANSFER_EXPIRY = 24 * 60 * 60
+TRANSFER_EXPIRY_INTERVAL = 60 * 60
+
+# The amount of seconds a keep-alive connection may stay idle
+# between requests, before the server closes it
+KEEP_ALIVE_TIMEOUT = 60
+
+# The amount of seconds a subscription may go without any messages,
+# before the server sends an empty batch to check the client is still there
+SUBSCRIPTION_HEARTBEAT = 30
+
+# The amount of bytes of a pushed batch the receiver is expected to go through
+# each second, it confirms a batch only once it handled all of its messages,
+# so it has this much more time (on top of KEEP_ALIVE_TIMEOUT) for a large one
+SUBSCRIPTION_ACK_RATE = 1024 * 1024
+
 
 def load_port(location=PORT_LOCATION):
     """Loads a port number from a config file
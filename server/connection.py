@@ -3,6 +3,12 @@
 Every connection is handled as a thread,
 and work concurrently to other connection.
 
+A connection serves a single request, unless the request
+asks to keep it alive, in which case the connection keeps
+serving requests until the client closes it, or stays idle
+for too long. A subscription to the pending messages takes over the
+connection, and pushes the messages over it as they arrive.
+
 Example:
 conn, addr = sock.accept()
 Connection(db_instance, conn).start()
@@ -11,7 +17,9 @@ from __future__ import annotations
 from typing import Union
 
 from io import BytesIO
+import calendar
 import threading
+import time
 import socket
 import logging
 import tempfile
@@ -37,22 +45,55 @@ class Connection(threading.Thread):
 
     def run(self):
         try:
-            server_response = self._process_request()
-            for data_chunk in server_response.write():
-                self._sock.send(data_chunk)
+            header = request.Header.read(self._sock)
+            while True:
+                server_response = self._process_request(header)
+                if server_response is None:
+                    return  # the handler was done with the connection
+                for data_chunk in server_response.write():
+                    self._sock.send(data_chunk)
+                server_response.sent()
+                # A failed request may leave unread data in the connection,
+                # so only a successful one can keep the connection alive.
+                if not header.keep_alive or isinstance(server_response,
+                                                       response.Error):
+                    return
+                self._sock.settimeout(config.KEEP_ALIVE_TIMEOUT)
+                try:
+                    header = request.Header.read(self._sock)
+                except (EOFError, socket.timeout):
+                    return  # the client is done with this connection
+                # The timeout only limits the idle time between requests,
+                # not the time a request takes, like the first one.
+                self._sock.settimeout(None)
         except Exception as err:  # pylint: disable=broad-except
             logger.debug('Could not complete a request, reason: %s', err)
             return
+        finally:
+            self._sock.close()
 
-    def _process_request(self) -> response.ResponseSchema:
-        """High-level processing of the request"""
-        header = request.Header.read(self._sock)
+    def _process_request(
+        self, header: request.Header
+    ) -> Union[response.ResponseSchema, None]:
+        """High-level processing of the request
+
+        Returns:
+            The response to send, or None if the handler already
+            answered over the connection, and is done with it.
+        """
         handlers = {
             request.Register.CODE: self._register_request,
             request.ClientList.CODE: self._retreive_client_list,
+            request.ClientListSince.CODE: self._retreive_client_list_since,
             request.PublicKey.CODE: self._get_public_key,
             request.SendMessage.CODE: self._send_message,
+            request.SendMessageBatch.CODE: self._send_message_batch,
+            request.SendMessagePart.CODE: self._send_message_part,
             request.PendingMessages.CODE: self._retreive_pending_messages,
+            request.PendingMessagesFrom.CODE:
+            self._retreive_pending_messages_from,
+            request.SubscribePendingMessages.CODE:
+            self._subscribe_pending_messages,
         }
         handler = handlers.get(
             header.code.value,
@@ -76,9 +117,43 @@ class Connection(threading.Thread):
         requester = self._login(header.client_id)
         if not requester:
             return response.Error()
+        payload, payload_size, _ = self._dump_client_list(requester)
+        return response.ClientList(payload, payload_size)
+
+    def _retreive_client_list_since(self, header: request.Header):
+        requester = self._login(header.client_id)
+        if not requester:
+            return response.Error()
+        try:
+            data = request.ClientListSince.read(self._sock,
+                                                header.payload_size)
+        except pt_exceptions.ProtocolError as err:
+            logger.debug('%s', err)
+            return response.Error()
+        # Anything that changes from now on is seen at this second or later,
+        # so it'll be part of the next request that sends this version.
+        version = pt_types.Timestamp(int(time.time()))
+        payload, payload_size, resume_since = self._dump_client_list(
+            requester, data.since.value)
+        if resume_since is not None:
+            # The rest will be sent next time, starting from the second the
+            # last client we send was seen, as the clients are ordered by it.
+            version = pt_types.Timestamp(resume_since)
+        return response.ClientListSince(version, payload, payload_size)
+
+    def _dump_client_list(self, requester: db_types.Client, since: int = 0):
+        """Dumps the client list into a temporary file
+
+        Returns:
+            The payload in chunks, the size of the payload, and None if all
+            clients fit into the payload, otherwise the time (seconds since
+            the unix epoch) the last client in the payload was seen.
+        """
         # We need to predict the payload size before sending it
         dump_payload = tempfile.TemporaryFile()
-        for client_chunk in self._db.get_client_list():
+        resume_since = None
+        last_seen = since
+        for client_chunk in self._db.get_client_list(since=since):
             for db_client in client_chunk:
                 if db_client.client_id.value == requester.client_id.value:
                     continue  # avoid returning the requester
@@ -88,16 +163,22 @@ class Connection(threading.Thread):
                 )
                 if (client.SIZE + dump_payload.tell()
                     ) >= pt_types.PayloadSize.MAX_PAYLOAD_SIZE:
+                    resume_since = last_seen
                     break  # we can not add more clients to the response
                 for data_chunk in client.write():
                     dump_payload.write(data_chunk)
+                last_seen = calendar.timegm(
+                    time.strptime(db_client.last_seen, '%Y-%m-%d %H:%M:%S'))
+            if resume_since is not None:
+                break
         payload_size = dump_payload.tell()
         dump_payload.seek(0)
 
-        return response.ClientList(
+        return (
             (dump_payload.read(chunk_size) for chunk_size in
              utils.get_chunk_sizes(payload_size, config.DATA_CHUNK_SIZE)),
             payload_size,
+            resume_since,
         )
 
     def _get_public_key(self, header: request.Header):
@@ -113,7 +194,7 @@ class Connection(threading.Thread):
             logger.debug(
                 '%s tried to get the public_key of an unregistered client(%s)',
                 request, data.client_id)
-            return response.Error
+            return response.Error()
 
     def _send_message(self, header: request.Header):
         sender = self._login(header.client_id)
@@ -148,26 +229,207 @@ class Connection(threading.Thread):
 
         return response.MessageSent(receiver.client_id, message_id)
 
+    def _send_message_batch(self, header: request.Header):
+        sender = self._login(header.client_id)
+        if not sender:
+            return response.Error()
+        try:
+            data = request.SendMessageBatch.read(self._sock, header.payload_size)
+        except pt_exceptions.ProtocolError as err:
+            logger.debug('%s', err)
+            return response.Error()
+        if not data.messages:
+            logger.debug('%s sent an empty batch', sender.client_id)
+            return response.Error()
+        # All receivers are resolved first, so either all
+        # of the messages are sent, or none of them.
+        receivers = {}
+        try:
+            for message in data.messages:
+                receiver_id = message.receiver_id.value
+                if receiver_id not in receivers:
+                    receivers[receiver_id] = self._db.fetch_client(
+                        message.receiver_id)
+        except ValueError:
+            logger.debug(
+                '%s tried to send a message to an unregistered client(%s)',
+                sender.client_id, message.receiver_id)
+            return response.Error()
+        try:
+            message_ids = self._db.create_messages(sender, [
+                (receivers[message.receiver_id.value], message.message_type,
+                 message.message_content) for message in data.messages
+            ])
+        except OverflowError as err:
+            logger.debug('%s tried to send a batch of %i messages (%s)',
+                         sender.client_id, len(data.messages), err)
+            return response.Error()
+
+        return response.MessageBatchSent([
+            (message.receiver_id, message_id)
+            for message, message_id in zip(data.messages, message_ids)
+        ])
+
+    def _send_message_part(self, header: request.Header):
+        sender = self._login(header.client_id)
+        if not sender:
+            return response.Error()
+        try:
+            data = request.SendMessagePart.read(self._sock,
+                                                header.payload_size)
+        except pt_exceptions.ProtocolError as err:
+            logger.debug('%s', err)
+            return response.Error()
+        try:
+            receiver = self._db.fetch_client(data.receiver_id)
+            if not data.transfer_id.value:
+                data.transfer_id = self._db.create_transfer(
+                    sender,
+                    receiver,
+                    data.message_type,
+                    data.message_size,
+                )
+            transfer = self._db.fetch_transfer(data.transfer_id)
+        except ValueError as err:
+            logger.debug('%s sent a part of an unknown transfer (%s)',
+                         sender.client_id, err)
+            return response.Error()
+        # Only the sender may continue a transfer, with the same arguments
+        if (transfer.from_id.value != sender.client_id.value
+                or transfer.to_id.value != receiver.client_id.value
+                or transfer.type.value != data.message_type.value
+                or transfer.size.value != data.message_size.value):
+            logger.debug('%s sent a part that does not match transfer %s',
+                         sender.client_id, transfer.id)
+            return response.Error()
+
+        # A part that doesn't continue the content is ignored, the sender
+        # learns from the response where it should continue from.
+        received = self._db.append_transfer_part(transfer, data.offset,
+                                                 data.part)
+        message_id = pt_types.MessageID(0)
+        if received == transfer.size.value:
+            try:
+                message_id = self._db.complete_transfer(transfer)
+            except OverflowError as err:
+                logger.debug(
+                    '%s tried to send a message of size %s but received an error(%s)',
+                    sender.client_id, transfer.size, err)
+                return response.Error()
+
+        return response.MessagePartReceived(
+            receiver.client_id,
+            transfer.id,
+            pt_types.MessageSize(received),
+            message_id,
+        )
+
     def _retreive_pending_messages(self, header: request.Header):
         receiver = self._login(header.client_id)
         if not receiver:
             return response.Error()
+        return self._dump_pending_messages(receiver, acknowledged=False)
+
+    def _retreive_pending_messages_from(self, header: request.Header):
+        receiver = self._login(header.client_id)
+        if not receiver:
+            return response.Error()
+        try:
+            data = request.PendingMessagesFrom.read(self._sock,
+                                                    header.payload_size)
+        except pt_exceptions.ProtocolError as err:
+            logger.debug('%s', err)
+            return response.Error()
+        # The receiver already has the messages that precede the one it
+        # asks for, they were only kept in case it didn't.
+        self._db.delete_messages_before(receiver, data.message_id)
+        return self._dump_pending_messages(receiver,
+                                           acknowledged=True,
+                                           first_id=data.message_id.value,
+                                           offset=data.offset.value)
+
+    def _subscribe_pending_messages(self, header: request.Header):
+        receiver = self._login(header.client_id)
+        if not receiver:
+            return response.Error()
+        try:
+            data = request.SubscribePendingMessages.read(
+                self._sock, header.payload_size)
+        except pt_exceptions.ProtocolError as err:
+            logger.debug('%s', err)
+            return response.Error()
+        next_id = data.message_id
+        while True:
+            # The receiver already has the messages that precede the next one
+            self._db.delete_messages_before(receiver, next_id)
+
+            # Taken before the messages are fetched, so a message that
+            # arrives in between wakes us up right away.
+            arrivals = self._db.message_arrivals(receiver)
+            batch = self._dump_pending_messages(receiver,
+                                                acknowledged=True,
+                                                first_id=next_id.value)
+            while batch.empty() and self._db.wait_for_messages(
+                    receiver, arrivals, config.SUBSCRIPTION_HEARTBEAT):
+                arrivals = self._db.message_arrivals(receiver)
+                batch = self._dump_pending_messages(receiver,
+                                                    acknowledged=True,
+                                                    first_id=next_id.value)
+
+            # An empty batch is a heartbeat, it's confirmed all the same
+            for data_chunk in batch.write():
+                self._sock.send(data_chunk)
+            self._sock.settimeout(config.KEEP_ALIVE_TIMEOUT +
+                                  batch.size() / config.SUBSCRIPTION_ACK_RATE)
+            try:
+                next_id = pt_types.MessageID.read(
+                    BytesIO(self._sock.recv(pt_types.MessageID.SIZE, True)))
+            except (EOFError, socket.timeout):
+                return None  # the client is done with the subscription
+            # Only the acknowledgment is limited, not sending the next batch
+            self._sock.settimeout(None)
+
+    def _dump_pending_messages(self,
+                               receiver: db_types.Client,
+                               acknowledged: bool,
+                               first_id: int = 0,
+                               offset: int = 0):
+        """Dumps the pending messages of a receiver into a response
+
+        Args:
+            acknowledged: whether the receiver confirms the messages it
+                received by asking for the ones after them, otherwise
+                they're deleted once the response was sent.
+            first_id: the id of the first message to return.
+            offset: the amount of bytes to skip at the start of the content
+                of the first message, if it's the one with that id.
+        """
         # It's possible that we'll have to retrieve thousands of
         # messages. However, we do limit the size of the payload we return,
         # so we shouldn't have a problem using a temp file, and we don't
         # have to worry about the extensive reading & writing.
         dump_payload = tempfile.TemporaryFile()
         dump_message_ids = tempfile.TemporaryFile()
-        for message_chunk in self._db.get_messages(receiver):
+        full = False
+        for message_chunk in self._db.get_messages(receiver,
+                                                   first_id=first_id):
+            if full:
+                break
             for db_message in message_chunk:
                 message = response.Message(
                     db_message.from_client.client_id,
                     db_message.id,
                     db_message.type,
                     db_message.content,
+                    offset if db_message.id.value == first_id else 0,
                 )
                 if (message.get_size() + dump_payload.tell()
                     ) >= pt_types.PayloadSize.MAX_PAYLOAD_SIZE:
+                    if acknowledged:
+                        # The receiver confirms every message up to the
+                        # last one it gets, so none of them may be skipped.
+                        full = True
+                        break
                     # If the message is too big, we'll have to skip it this time
                     # the receiver still have a chance to fetch it the next time.
                     continue
@@ -177,7 +439,13 @@ class Connection(threading.Thread):
         payload_size = dump_payload.tell()
         dump_payload.seek(0)
 
-        # Delete the messages we decided to return this time
+        payload = (dump_payload.read(chunk_size) for chunk_size in
+                   utils.get_chunk_sizes(payload_size, config.DATA_CHUNK_SIZE))
+        if acknowledged:
+            return response.PendingMessages(payload, payload_size)
+
+        # Delete the messages we decided to return this time,
+        # once they were sent.
         def generate_ids(dump_data):
             dump_data.seek(0)
             while True:
@@ -186,12 +454,10 @@ class Connection(threading.Thread):
                     break
                 yield pt_types.MessageID.read(BytesIO(data))
 
-        self._db.delete_messages(generate_ids(dump_message_ids))
-
         return response.PendingMessages(
-            (dump_payload.read(chunk_size) for chunk_size in
-             utils.get_chunk_sizes(payload_size, config.DATA_CHUNK_SIZE)),
+            payload,
             payload_size,
+            lambda: self._db.delete_messages(generate_ids(dump_message_ids)),
         )
 
     def _login(self,
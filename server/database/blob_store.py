@@ -0,0 +1,121 @@
+"""A content-addressed store of message contents on the disk
+
+Large contents are kept as files, named by the sha256 of their content,
+while the database only holds their digest. A content is first staged,
+written into a file of its own while it's hashed, without holding any
+lock, and only moved into place once the message that refers to it was
+committed.
+
+Moving a content into place and removing it should happen under the
+writer lock of the database, so a content is never removed right after
+another message started to refer to it.
+
+Example:
+store = BlobStore('blobs')
+staged = store.stage(content.write_by_chunks(config.DATA_CHUNK_SIZE))
+store.commit(staged)
+content = store.open(staged.digest)
+"""
+
+from typing import Iterator, List
+import hashlib
+import io
+import os
+import tempfile
+
+# The staged contents are kept next to the store, so moving them
+# into place is a rename, instead of a copy.
+STAGING_PREFIX = 'staged-'
+
+
+class StagedBlob():
+    """A content that was written to the disk, but isn't in the store yet"""
+    def __init__(self, path: str, digest: str):
+        self.path = path
+        self.digest = digest
+
+
+class BlobStore():
+    """Content-addressed files, under a root directory"""
+    def __init__(self, root: str):
+        self._root = root
+        os.makedirs(root, exist_ok=True)
+
+    def stage(self, chunks: Iterator[bytes]) -> StagedBlob:
+        """Writes a content into a staging file, and hashes it on the way
+
+        The caller either commits the staged content, or discards it.
+        """
+        digest = hashlib.sha256()
+        with tempfile.NamedTemporaryFile(dir=self._root,
+                                         prefix=STAGING_PREFIX,
+                                         delete=False) as staging:
+            try:
+                for chunk in chunks:
+                    digest.update(chunk)
+                    staging.write(chunk)
+            except BaseException:
+                staging.close()
+                os.remove(staging.name)
+                raise
+        return StagedBlob(staging.name, digest.hexdigest())
+
+    def commit(self, staged: StagedBlob) -> None:
+        """Moves a staged content into the store
+
+        The same content may already be there, in which case
+        it's replaced by an identical copy.
+        """
+        path = self.path(staged.digest)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        os.replace(staged.path, path)
+
+    @staticmethod
+    def discard(staged: StagedBlob) -> None:
+        """Removes a staged content, unless it was already committed"""
+        try:
+            os.remove(staged.path)
+        except FileNotFoundError:
+            pass
+
+    def open(self, digest: str) -> io.BufferedReader:
+        """Opens a content of the store for reading
+
+        Raises:
+            FileNotFoundError: the content is not in the store.
+        """
+        return open(self.path(digest), 'rb')
+
+    def remove(self, digest: str) -> None:
+        """Removes a content from the store, if it's there
+
+        A content that is still open for reading may not be removable
+        (on Windows), it's left for collect to remove later.
+        """
+        try:
+            os.remove(self.path(digest))
+        except OSError:
+            pass
+
+    def collect(self, referenced: List[str]) -> None:
+        """Removes the contents nobody refers to, and the staged leftovers
+
+        Should only run while nothing is staged, like when the server starts.
+
+        Args:
+            referenced: the digests of the contents that should be kept.
+        """
+        referenced = set(referenced)
+        for directory, _, files in os.walk(self._root):
+            for name in files:
+                if name in referenced:
+                    continue
+                try:
+                    os.remove(os.path.join(directory, name))
+                except OSError:
+                    pass
+
+    def path(self, digest: str) -> str:
+        """The path of a content, the contents are spread over directories
+        by the first two characters of their digest"""
+        return os.path.join(self._root, digest[:2], digest)
@@ -8,7 +8,8 @@ You should never use this directly; use an engine
 implementation of this interface design.
 """
 from abc import ABC, abstractmethod
-from typing import Iterator, List
+from typing import Iterator, List, Tuple
+import threading
 
 import config
 import rwlock
@@ -20,6 +21,52 @@ class Database(ABC):
     """Defines how a database interface should be structured."""
     def __init__(self):
         self._lock = rwlock.RWLock()
+        # The amount of messages that arrived for each receiver, and the
+        # condition its subscribers wait on, by the id of the receiver.
+        self._arrivals_lock = threading.Lock()
+        self._arrivals = {}
+
+    def message_arrivals(self, receiver: db_types.Client) -> int:
+        """The amount of messages that arrived for a receiver so far
+
+        Only the changes of this counter matter, pass it to
+        wait_for_messages before fetching the messages, so a message
+        that arrives in between is never missed.
+        """
+        with self._arrivals_lock:
+            return self._arrival_entry(receiver.client_id)[0]
+
+    def wait_for_messages(self, receiver: db_types.Client, arrivals: int,
+                          timeout: float) -> bool:
+        """Waits until a message arrives for a receiver
+
+        Args:
+            arrivals: the counter of message_arrivals the caller has seen.
+            timeout: the maximum amount of seconds to wait.
+
+        Returns:
+            Whether a message arrived since the counter was taken.
+        """
+        with self._arrivals_lock:
+            entry = self._arrival_entry(receiver.client_id)
+            return entry[1].wait_for(lambda: entry[0] != arrivals, timeout)
+
+    def _message_arrived(self, receiver_id: pt_types.ClientID) -> None:
+        """Wakes up the subscribers of a receiver
+
+        An engine calls it once a message for the receiver was committed.
+        """
+        with self._arrivals_lock:
+            entry = self._arrival_entry(receiver_id)
+            entry[0] += 1
+            entry[1].notify_all()
+
+    def _arrival_entry(self, receiver_id: pt_types.ClientID) -> list:
+        """The [counter, condition] of a receiver, holding _arrivals_lock"""
+        key = receiver_id.write()
+        if key not in self._arrivals:
+            self._arrivals[key] = [0, threading.Condition(self._arrivals_lock)]
+        return self._arrivals[key]
 
     @abstractmethod
     def create_client(self, username: pt_types.Username,
@@ -44,14 +91,22 @@ class Database(ABC):
     @abstractmethod
     def get_client_list(
         self,
-        chunk_size: int = config.DB_CHUNK_SIZE
+        chunk_size: int = config.DB_CHUNK_SIZE,
+        since: int = 0,
     ) -> Iterator[List[db_types.Client]]:
         """Fetches all clients from the database
 
+        The clients are ordered by the time they were last seen (and then
+        by their id), so a list that is cut short can be continued from
+        the time the last client it holds was seen.
+
         Args:
             chunk_size: the iterator yields the clients in chunks,
                 use this argument to control the maximum amount of
                 client in each chunk.
+            since: only fetch the clients that were seen since this
+                time (seconds since the unix epoch), a new client is
+                seen once it's created.
 
         Returns:
             An iterator that yields clients from the database.
@@ -65,7 +120,9 @@ class Database(ABC):
     def update_last_seen(self, client: db_types.Client) -> None:
         """Updates the last seen field of a client to 'now'
 
-        will not do anything in the case client can't be found
+        will not do anything in the case client can't be found.
+        An engine may defer the update, and apply the updates of several
+        clients at once, in which case 'now' is the time they're applied.
         """
 
     @abstractmethod
@@ -87,11 +144,87 @@ class Database(ABC):
             The id of the newly constructred message.
         """
 
+    @abstractmethod
+    def create_messages(
+        self, sender: db_types.Client,
+        messages: List[Tuple[db_types.Client, pt_types.MessageType,
+                             pt_types.MessageContent]]
+    ) -> List[pt_types.MessageID]:
+        """Adds several messages from the same sender to the db, at once
+
+        Args:
+            messages: the receiver, type and content of each message,
+                the function assumes the receivers exist.
+
+        Returns:
+            The ids of the newly constructred messages, in the same order.
+            Either all of the messages are added, or none of them.
+
+        Raises:
+            OverflowError: a content is too big to be stored.
+        """
+
+    @abstractmethod
+    def create_transfer(self, sender: db_types.Client,
+                        receiver: db_types.Client,
+                        message_type: pt_types.MessageType,
+                        size: pt_types.MessageSize) -> pt_types.MessageID:
+        """Adds a new transfer to the db
+
+        A transfer is a message whose content is sent in parts,
+        it becomes a message once all of its content was appended.
+        The transfer is deleted once it expires (see
+        config.TRANSFER_EXPIRY), whether it was completed or not.
+
+        Returns:
+            The id of the newly constructred transfer.
+        """
+
+    @abstractmethod
+    def fetch_transfer(self,
+                       transfer_id: pt_types.MessageID) -> db_types.Transfer:
+        """Fetches a transfer from the database
+
+        Raises:
+            ValueError: the transfer doesn't exist.
+        """
+
+    @abstractmethod
+    def append_transfer_part(self, transfer: db_types.Transfer,
+                             offset: pt_types.MessageSize,
+                             part: pt_types.MessageContent) -> int:
+        """Appends a part to the content of a transfer
+
+        The part is only appended if it starts exactly where the
+        content that was already received ends, and doesn't exceed
+        the size of the transfer, otherwise nothing happens.
+        That way a part that was sent twice is only stored once.
+
+        Returns:
+            The amount of bytes of the content that were received so far.
+        """
+
+    @abstractmethod
+    def complete_transfer(
+            self, transfer: db_types.Transfer) -> pt_types.MessageID:
+        """Turns a transfer whose content was fully received into a message
+
+        The transfer keeps the id of the message, so completing
+        it again returns the same message.
+
+        Returns:
+            The id of the message, or 0 if the content is not complete.
+
+        Raises:
+            OverflowError: the content is too big to be stored.
+        """
+
     @abstractmethod
     def get_messages(
         self,
         receiver: db_types.Client,
-        chunk_size: int = config.DB_CHUNK_SIZE
+        chunk_size: int = config.DB_CHUNK_SIZE,
+        first_id: int = 0,
     ) -> Iterator[List[db_types.Message]]:
         """Fetches all pending message from the database
 
@@ -101,9 +234,11 @@ class Database(ABC):
             chunk_size: the iterator yields the messages in chunks,
                 use this argument to control the maximum amount of
                 messages in each chunk.
+            first_id: messages with a smaller id are not fetched.
 
         Returns:
-            An iterator that yields messages from the database.
+            An iterator that yields messages from the database,
+            in the order they were created.
             Be aware that if a new message was sent while
             you were polling data, there is high possibility
             that you'll poll this client as well; you can not
@@ -122,3 +257,8 @@ class Database(ABC):
         It's ok if the list contains ids of messages that were not in the database
         to begin with.
         """
+
+    @abstractmethod
+    def delete_messages_before(self, receiver: db_types.Client,
+                               message_id: pt_types.MessageID) -> None:
+        """Deletes the messages of a receiver, that precede a given id"""
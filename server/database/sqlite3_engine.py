@@ -8,14 +8,18 @@ db = Sqlite3Engine('<file_name>')
 db.create_client(username, public_key)
 """
 
-from typing import Iterator, List
+from typing import Iterator, List, Tuple, Union
+from contextlib import closing
 from io import BytesIO
 
 import sqlite3
 import textwrap
+import threading
+import time
 import uuid
 import tempfile
 
+from database import blob_store
 from database import engine_interface
 from database import types as db_types
 from protocol import types as pt_types
@@ -23,12 +27,42 @@ import config
 
 
 class Sqlite3Engine(engine_interface.Database):
-    """The sqlite3 engine"""
-    def __init__(self, database_name):
+    """The sqlite3 engine
+
+    The database runs in WAL mode, with a connection for each thread,
+    so the readers never wait for a writer, or for each other, each
+    one reads a consistent snapshot of the database. The writers still
+    take the writer lock, as sqlite only allows a single writer anyway.
+    """
+    def __init__(self, database_name, blob_store_path=config.BLOB_STORE_PATH):
         super().__init__()
-        self._conn = sqlite3.connect(database_name, check_same_thread=False)
+        self._database_name = database_name
+        self._connections = threading.local()
+        self._blobs = blob_store.BlobStore(blob_store_path)
         self._setup()
 
+        # The clients that were seen since the last_seen column was
+        # updated, by their id, they're updated together once in a while.
+        self._seen_lock = threading.Lock()
+        self._seen = set()
+        threading.Thread(target=self._update_last_seen_periodically,
+                         daemon=True).start()
+        threading.Thread(target=self._expire_transfers_periodically,
+                         daemon=True).start()
+
+    @property
+    def _conn(self) -> sqlite3.Connection:
+        """The connection of the calling thread, opened on its first use"""
+        conn = getattr(self._connections, 'conn', None)
+        if conn is None:
+            conn = sqlite3.connect(self._database_name,
+                                   timeout=config.DB_BUSY_TIMEOUT)
+            # A crash may lose the last transactions, but never corrupts
+            # a database in WAL mode, so a commit doesn't wait for a sync.
+            conn.execute('PRAGMA synchronous=NORMAL')
+            self._connections.conn = conn
+        return conn
+
     def create_client(self, username: pt_types.Username,
                       public_key: pt_types.PublicKey) -> pt_types.ClientID:
         # It doesn't matter if the protocol changes the orientation
@@ -53,15 +87,14 @@ class Sqlite3Engine(engine_interface.Database):
         return client_id
 
     def fetch_client(self, client_id: pt_types.ClientID) -> db_types.Client:
-        with self._lock.reader():
-            cur = self._conn.execute(
-                'SELECT username, public_key, last_seen FROM clients WHERE id=(?)',
-                (client_id.write(), ),
-            )
-            try:
-                username, public_key, last_seen = cur.fetchone()
-            except TypeError as err:
-                raise ValueError('client does not exist') from err
+        cur = self._conn.execute(
+            'SELECT username, public_key, last_seen FROM clients WHERE id=(?)',
+            (client_id.write(), ),
+        )
+        try:
+            username, public_key, last_seen = cur.fetchone()
+        except TypeError as err:
+            raise ValueError('client does not exist') from err
 
         return db_types.Client(
             client_id,
@@ -72,136 +105,474 @@ class Sqlite3Engine(engine_interface.Database):
 
     def get_client_list(
         self,
-        chunk_size: int = config.DB_CHUNK_SIZE
+        chunk_size: int = config.DB_CHUNK_SIZE,
+        since: int = 0,
     ) -> Iterator[List[db_types.Client]]:
         assert chunk_size > 0, "can't return chunks of negative amount of rows"
 
-        with self._lock.reader():
-            cur = self._conn.execute(
-                'SELECT id, username, public_key, last_seen FROM clients')
-        while True:
-            # We need to lock before reading a new result.
-            # This pattern prevent locking the database for
-            # a long time, in case the client list is huge,
-            # and/or the one using the generator takes his time
-            # between sequentives calls to this generator.
-            with self._lock.reader():
+        # The cursor holds a snapshot of the database until it's
+        # closed, even if the one using the generator stops early.
+        with closing(
+                self._conn.execute(
+                    textwrap.dedent("""
+                        SELECT id, username, public_key, last_seen FROM clients
+                        WHERE last_seen >= datetime(?, 'unixepoch')
+                        ORDER BY last_seen, id
+                    """),
+                    (since, ),
+                )) as cur:
+            while True:
                 result = cur.fetchmany(chunk_size)
-            if not result:
-                break
-            # Convert the row-data from the db into proper Client structures, and yield them
-            yield [
-                db_types.Client(
-                    pt_types.ClientID.read(BytesIO(client_id)),
-                    pt_types.Username.read(BytesIO(username)),
-                    pt_types.PublicKey.read(BytesIO(public_key)),
-                    last_seen,
-                ) for client_id, username, public_key, last_seen in result
-            ]
+                if not result:
+                    break
+                # Convert the row-data from the db into proper Client structures, and yield them
+                yield [
+                    db_types.Client(
+                        pt_types.ClientID.read(BytesIO(client_id)),
+                        pt_types.Username.read(BytesIO(username)),
+                        pt_types.PublicKey.read(BytesIO(public_key)),
+                        last_seen,
+                    ) for client_id, username, public_key, last_seen in result
+                ]
 
     def update_last_seen(self, client: db_types.Client) -> None:
-        """Updates the last_seen column to 'now'"""
-        with self._lock.writer():
-            with self._conn:
-                self._conn.execute(
-                    "UPDATE clients SET last_seen = datetime('now') WHERE id=(?)",
-                    (client.client_id.write(), ),
-                )
+        """Marks the client as seen, its last_seen column is updated
+        to the time of the next periodic update"""
+        with self._seen_lock:
+            self._seen.add(client.client_id.write())
 
     def create_message(self, sender: db_types.Client,
                        receiver: db_types.Client,
                        message_type: pt_types.MessageType,
                        content: pt_types.MessageContent) -> pt_types.MessageID:
-        # Note that the db saves the content directly into the database,
-        # this can be an expensive operation, and considering that it's
-        # encrypted anyway (we can't process any valuable query on it),
-        # we should prefer saving it to a persistent storage, and only the path
-        # in the database.
-        # I've tried to abstract it as much as possible, so one would only need
-        # to edit this sqlite3 engine in order to implement this change.
-        # However, I didn't implement it because we are not allowed to change
-        # the database schema for this project. While I could use the blob in
-        # a hacky way in order to implement it, it seems like I'll lose points for this.
+        # A large content is streamed into the blob store before the lock
+        # is taken, so the lock is only held while the rows are inserted.
+        prepared = self._prepare_content(
+            content.size.value,
+            content.write_by_chunks(config.DATA_CHUNK_SIZE))
+        try:
+            with self._lock.writer():
+                with self._conn:
+                    message_id = self._insert_message(
+                        sender.client_id,
+                        receiver.client_id,
+                        message_type,
+                        prepared,
+                    )
+                self._commit_staged(prepared)
+        finally:
+            self._discard_staged(prepared)
+        self._message_arrived(receiver.client_id)
+        return message_id
+
+    def create_messages(
+        self, sender: db_types.Client,
+        messages: List[Tuple[db_types.Client, pt_types.MessageType,
+                             pt_types.MessageContent]]
+    ) -> List[pt_types.MessageID]:
+        # A single transaction for all of them, so the batch is committed
+        # (and synced to the disk) once.
+        prepared = []
+        try:
+            for _, _, content in messages:
+                prepared.append(
+                    self._prepare_content(
+                        content.size.value,
+                        content.write_by_chunks(config.DATA_CHUNK_SIZE)))
+            with self._lock.writer():
+                with self._conn:
+                    message_ids = [
+                        self._insert_message(
+                            sender.client_id,
+                            receiver.client_id,
+                            message_type,
+                            content,
+                        ) for (receiver, message_type,
+                               _), content in zip(messages, prepared)
+                    ]
+                for content in prepared:
+                    self._commit_staged(content)
+        finally:
+            for content in prepared:
+                self._discard_staged(content)
+        # Each receiver is woken up once, however many messages it got
+        receivers = {
+            receiver.client_id.write(): receiver.client_id
+            for receiver, _, _ in messages
+        }
+        for receiver_id in receivers.values():
+            self._message_arrived(receiver_id)
+        return message_ids
+
+    def create_transfer(self, sender: db_types.Client,
+                        receiver: db_types.Client,
+                        message_type: pt_types.MessageType,
+                        size: pt_types.MessageSize) -> pt_types.MessageID:
         with self._lock.writer():
             with self._conn:
-                try:
-                    cur = self._conn.execute(
-                        'INSERT INTO messages(from_id, to_id, type, content) VALUES (?, ?, ?, ?)',
-                        (
-                            sender.client_id.write(),
-                            receiver.client_id.write(),
-                            message_type.value,
-                            content.write(),  # <- extremely inefficient
-                        ),
-                    )
-                except sqlite3.InterfaceError as err:
-                    # Another problem with saving the content
-                    # as a blob in the database, instead of a path.
-                    raise OverflowError('content size is too big') from err
+                cur = self._conn.execute(
+                    "INSERT INTO transfers(from_id, to_id, type, size, created) VALUES (?, ?, ?, ?, datetime('now'))",
+                    (
+                        sender.client_id.write(),
+                        receiver.client_id.write(),
+                        message_type.value,
+                        size.value,
+                    ),
+                )
                 return pt_types.MessageID(cur.lastrowid)
 
+    def fetch_transfer(self,
+                       transfer_id: pt_types.MessageID) -> db_types.Transfer:
+        cur = self._conn.execute(
+            textwrap.dedent("""
+                SELECT from_id, to_id, type, size, received, message_id
+                FROM transfers WHERE id=(?)
+            """),
+            (transfer_id.value, ),
+        )
+        try:
+            (from_id, to_id, message_type, size, received,
+             message_id) = cur.fetchone()
+        except TypeError as err:
+            raise ValueError('transfer does not exist') from err
+
+        return db_types.Transfer(
+            transfer_id,
+            pt_types.ClientID.read(BytesIO(from_id)),
+            pt_types.ClientID.read(BytesIO(to_id)),
+            pt_types.MessageType(message_type),
+            pt_types.MessageSize(size),
+            pt_types.MessageSize(received),
+            pt_types.MessageID(message_id),
+        )
+
+    def append_transfer_part(self, transfer: db_types.Transfer,
+                             offset: pt_types.MessageSize,
+                             part: pt_types.MessageContent) -> int:
+        with self._lock.writer():
+            with self._conn:
+                # The transfer may have changed since it was fetched,
+                # so its state is checked again along with the update.
+                cur = self._conn.execute(
+                    textwrap.dedent("""
+                        UPDATE transfers SET received = received + ?
+                        WHERE id=(?) AND received=(?) AND received + ? <= size
+                    """),
+                    (
+                        part.size.value,
+                        transfer.id.value,
+                        offset.value,
+                        part.size.value,
+                    ),
+                )
+                if cur.rowcount and part.size.value:
+                    self._conn.execute(
+                        'INSERT INTO transfer_parts(transfer_id, offset, content) VALUES (?, ?, ?)',
+                        (transfer.id.value, offset.value, part.write()),
+                    )
+                (received, ) = self._conn.execute(
+                    'SELECT received FROM transfers WHERE id=(?)',
+                    (transfer.id.value, ),
+                ).fetchone()
+                return received
+
+    def complete_transfer(
+            self, transfer: db_types.Transfer) -> pt_types.MessageID:
+        (size, received, message_id) = self._conn.execute(
+            'SELECT size, received, message_id FROM transfers WHERE id=(?)',
+            (transfer.id.value, ),
+        ).fetchone()
+        if message_id or received != size:
+            return pt_types.MessageID(message_id)
+
+        # The parts are only assembled once, into the message itself.
+        # They don't change once all of them were received, so they're
+        # assembled without holding the writer lock.
+        prepared = self._prepare_content(size, self._transfer_parts(transfer))
+        try:
+            with self._lock.writer():
+                with self._conn:
+                    # Another request may have completed it in the meantime
+                    (message_id, ) = self._conn.execute(
+                        'SELECT message_id FROM transfers WHERE id=(?)',
+                        (transfer.id.value, ),
+                    ).fetchone()
+                    if message_id:
+                        return pt_types.MessageID(message_id)
+
+                    message_id = self._insert_message(
+                        transfer.from_id,
+                        transfer.to_id,
+                        transfer.type,
+                        prepared,
+                    )
+                    self._conn.execute(
+                        'UPDATE transfers SET message_id = ? WHERE id=(?)',
+                        (message_id.value, transfer.id.value),
+                    )
+                    self._conn.execute(
+                        'DELETE FROM transfer_parts WHERE transfer_id=(?)',
+                        (transfer.id.value, ),
+                    )
+                self._commit_staged(prepared)
+        finally:
+            self._discard_staged(prepared)
+        self._message_arrived(transfer.to_id)
+        return message_id
+
     def get_messages(
         self,
         receiver: db_types.Client,
-        chunk_size: int = 1  # because the content can be huge
+        chunk_size: int = 1,  # because the content can be huge
+        first_id: int = 0,
     ) -> Iterator[List[db_types.Message]]:
         assert chunk_size > 0, "can't return chunks of negative amount of rows"
-        with self._lock.reader():
-            cur = self._conn.execute(
-                textwrap.dedent("""
-                    SELECT messages.id, type, content, from_id, username, public_key, last_seen 
-                    FROM clients, messages 
-                    WHERE from_id = clients.id AND to_id=(?)
-                """),
-                (receiver.client_id.write(), ),
-            )
-        while True:
-            # We need to lock before reading a new result.
-            # This pattern prevent locking the database for
-            # a long time, in case the message-list is huge,
-            # and/or the one using the generator takes his time
-            # between sequentives calls to this generator.
-            with self._lock.reader():
+        # The cursor holds a snapshot of the database until it's
+        # closed, even if the one using the generator stops early.
+        with closing(
+                self._conn.execute(
+                    textwrap.dedent("""
+                        SELECT messages.id, type, content, digest, from_id, username, public_key, last_seen
+                        FROM clients, messages
+                        LEFT JOIN message_blobs ON message_blobs.message_id = messages.id
+                        WHERE from_id = clients.id AND to_id=(?) AND messages.id >= (?)
+                        ORDER BY messages.id
+                    """),
+                    (receiver.client_id.write(), first_id),
+                )) as cur:
+            while True:
                 result = cur.fetchmany(chunk_size)
-            if not result:
-                break
-            # Convert the row-data from the db into proper Message structures, and yield them
-            parsed_result = []
-            for (message_id, message_type, raw_content, sender_id,
-                 sender_username, sender_public_key,
-                 sender_last_seen) in result:
-                # we can use the built-in read function, but
-                # there's no reason to build the temp-file in chunks.
-                temp_file = tempfile.TemporaryFile()
-                temp_file.write(raw_content)
-                content = pt_types.MessageContent(temp_file)
-                sender = db_types.Client(
-                    pt_types.ClientID.read(BytesIO(sender_id)),
-                    pt_types.Username.read(BytesIO(sender_username)),
-                    pt_types.PublicKey.read(BytesIO(sender_public_key)),
-                    sender_last_seen,
-                )
-                message = db_types.Message(
-                    pt_types.MessageID(message_id),
-                    sender,
-                    receiver,
-                    pt_types.MessageType(message_type),
-                    content,
-                )
-                parsed_result.append(message)
-            yield parsed_result
+                if not result:
+                    break
+                # Convert the row-data from the db into proper Message structures, and yield them
+                parsed_result = []
+                for (message_id, message_type, raw_content, digest, sender_id,
+                     sender_username, sender_public_key,
+                     sender_last_seen) in result:
+                    content = self._open_content(raw_content, digest)
+                    if not content:
+                        continue  # it was deleted since the snapshot
+                    sender = db_types.Client(
+                        pt_types.ClientID.read(BytesIO(sender_id)),
+                        pt_types.Username.read(BytesIO(sender_username)),
+                        pt_types.PublicKey.read(BytesIO(sender_public_key)),
+                        sender_last_seen,
+                    )
+                    message = db_types.Message(
+                        pt_types.MessageID(message_id),
+                        sender,
+                        receiver,
+                        pt_types.MessageType(message_type),
+                        content,
+                    )
+                    parsed_result.append(message)
+                yield parsed_result
 
     def delete_messages(self,
                         message_ids: Iterator[pt_types.MessageID]) -> None:
+        message_ids = [id.value for id in message_ids]
         with self._lock.writer():
             with self._conn:
+                released = self._release_blobs(message_ids)
                 self._conn.executemany(
                     'DELETE FROM messages WHERE id=(?)',
-                    ((id.value, ) for id in message_ids),
+                    ((id, ) for id in message_ids),
+                )
+            for digest in released:
+                self._blobs.remove(digest)
+
+    def delete_messages_before(self, receiver: db_types.Client,
+                               message_id: pt_types.MessageID) -> None:
+        with self._lock.writer():
+            with self._conn:
+                released = self._release_blobs([
+                    id for (id, ) in self._conn.execute(
+                        'SELECT id FROM messages WHERE to_id=(?) AND id < (?)',
+                        (receiver.client_id.write(), message_id.value),
+                    )
+                ])
+                self._conn.execute(
+                    'DELETE FROM messages WHERE to_id=(?) AND id < (?)',
+                    (receiver.client_id.write(), message_id.value),
+                )
+            for digest in released:
+                self._blobs.remove(digest)
+
+    def _insert_message(
+            self, from_id: pt_types.ClientID, to_id: pt_types.ClientID,
+            message_type: pt_types.MessageType,
+            content: Union[bytes, blob_store.StagedBlob]) -> pt_types.MessageID:
+        """Inserts a new message, the caller holds the lock
+
+        Args:
+            content: a content of _prepare_content, the caller passes
+                it to _commit_staged once the transaction was committed.
+
+        Raises:
+            OverflowError: the content is too big to be stored.
+        """
+        staged = isinstance(content, blob_store.StagedBlob)
+        try:
+            cur = self._conn.execute(
+                'INSERT INTO messages(from_id, to_id, type, content) VALUES (?, ?, ?, ?)',
+                (
+                    from_id.write(),
+                    to_id.write(),
+                    message_type.value,
+                    b'' if staged else content,
+                ),
+            )
+        except sqlite3.InterfaceError as err:
+            # Another problem with saving the content
+            # as a blob in the database, instead of a path.
+            raise OverflowError('content size is too big') from err
+        if staged:
+            self._conn.execute(
+                'INSERT INTO message_blobs(message_id, digest) VALUES (?, ?)',
+                (cur.lastrowid, content.digest),
+            )
+        return pt_types.MessageID(cur.lastrowid)
+
+    def _prepare_content(
+            self, size: int,
+            chunks: Iterator[bytes]) -> Union[bytes, blob_store.StagedBlob]:
+        """Prepares a content to be inserted, before the lock is taken
+
+        A small content is kept in the database itself, a large one
+        is staged in the blob store. The caller should pass it to
+        _commit_staged once its message was committed, and in any case
+        to _discard_staged at the end.
+        """
+        if size <= config.BLOB_THRESHOLD:
+            return b''.join(chunks)
+        return self._blobs.stage(chunks)
+
+    def _commit_staged(self, content: Union[bytes,
+                                            blob_store.StagedBlob]) -> None:
+        """Moves a staged content into the blob store, if there is one,
+        the caller holds the writer lock
+
+        Only done after the transaction that refers to the content was
+        committed, so a transaction that is rolled back never leaves its
+        content in the store. The writer lock is still held, so the same
+        content is never removed in between by a delete.
+        """
+        if isinstance(content, blob_store.StagedBlob):
+            self._blobs.commit(content)
+
+    def _discard_staged(self, content: Union[bytes,
+                                             blob_store.StagedBlob]) -> None:
+        """Removes a staged content that wasn't inserted, if there is one"""
+        if isinstance(content, blob_store.StagedBlob):
+            self._blobs.discard(content)
+
+    def _transfer_parts(self, transfer: db_types.Transfer) -> Iterator[bytes]:
+        """Yields the parts of a transfer, in order"""
+        with closing(
+                self._conn.execute(
+                    'SELECT content FROM transfer_parts WHERE transfer_id=(?) ORDER BY offset',
+                    (transfer.id.value, ),
+                )) as cur:
+            for (part, ) in cur:
+                yield part
+
+    def _open_content(
+            self, raw_content: bytes,
+            digest: Union[str, None]) -> Union[pt_types.MessageContent, None]:
+        """The content of a message, from the blob store if it's there
+
+        Returns:
+            The content, or None if the message was deleted (along with
+            its content) since it was read from the database.
+        """
+        if digest:
+            try:
+                return pt_types.MessageContent(self._blobs.open(digest))
+            except FileNotFoundError:
+                return None
+        # we can use the built-in read function, but
+        # there's no reason to build the temp-file in chunks.
+        temp_file = tempfile.TemporaryFile()
+        temp_file.write(raw_content)
+        return pt_types.MessageContent(temp_file)
+
+    def _update_last_seen_periodically(self) -> None:
+        """Updates the last_seen column of the clients that were seen,
+        all of them in a single transaction, once in a while"""
+        while True:
+            time.sleep(config.LAST_SEEN_INTERVAL)
+            with self._seen_lock:
+                seen, self._seen = self._seen, set()
+            if not seen:
+                continue
+            try:
+                with self._lock.writer():
+                    with self._conn:
+                        self._conn.executemany(
+                            "UPDATE clients SET last_seen = datetime('now') WHERE id=(?)",
+                            ((client_id, ) for client_id in seen),
+                        )
+            except sqlite3.Error:
+                with self._seen_lock:
+                    self._seen |= seen  # tried again the next time
+
+    def _expire_transfers(self) -> None:
+        """Deletes the transfers that expired, along with their parts
+
+        A completed transfer is kept until then as well, so a sender
+        whose last part is sent again still learns the id of the message.
+        """
+        expired = "created < datetime('now', ?)"
+        age = ('-%i seconds' % config.TRANSFER_EXPIRY, )
+        with self._lock.writer():
+            with self._conn:
+                self._conn.execute(
+                    'DELETE FROM transfer_parts WHERE transfer_id IN '
+                    '(SELECT id FROM transfers WHERE %s)' % expired, age)
+                self._conn.execute('DELETE FROM transfers WHERE ' + expired,
+                                   age)
+
+    def _expire_transfers_periodically(self) -> None:
+        """Deletes the transfers that expired, once in a while"""
+        while True:
+            time.sleep(config.TRANSFER_EXPIRY_INTERVAL)
+            try:
+                self._expire_transfers()
+            except sqlite3.Error:
+                pass  # tried again the next time
+
+    def _release_blobs(self, message_ids: List[int]) -> List[str]:
+        """Drops the references of messages that are about to be deleted,
+        the caller holds the writer lock
+
+        Only the digests of those messages are checked for other
+        references, each one through the index.
+
+        Returns:
+            The digests of the contents nobody refers to anymore.
+        """
+        digests = set()
+        for message_id in message_ids:
+            row = self._conn.execute(
+                'SELECT digest FROM message_blobs WHERE message_id=(?)',
+                (message_id, ),
+            ).fetchone()
+            if row:
+                digests.add(row[0])
+                self._conn.execute(
+                    'DELETE FROM message_blobs WHERE message_id=(?)',
+                    (message_id, ),
                 )
+        return [
+            digest for digest in digests if not self._conn.execute(
+                'SELECT 1 FROM message_blobs WHERE digest=(?)',
+                (digest, )).fetchone()
+        ]
 
     def _setup(self) -> None:
         """Initializes the tables if necessary"""
+        # The mode is kept in the database file, for all its connections
+        self._conn.execute('PRAGMA journal_mode=WAL')
         with self._conn:
             # Clients table
             self._conn.execute(
@@ -218,6 +589,9 @@ class Sqlite3Engine(engine_interface.Database):
                     pt_types.Username.SIZE,
                     pt_types.PublicKey.SIZE,
                 )), )
+            self._conn.execute(
+                'CREATE INDEX IF NOT EXISTS clients_last_seen ON clients(last_seen, id)'
+            )
             # Messages table
             self._conn.execute(
                 textwrap.dedent("""
@@ -234,3 +608,64 @@ class Sqlite3Engine(engine_interface.Database):
                     pt_types.ClientID.SIZE,
                     pt_types.ClientID.SIZE,
                 )), )
+            # Messages that are being sent in parts, and their parts
+            self._conn.execute(
+                textwrap.dedent("""
+                    CREATE TABLE IF NOT EXISTS transfers(
+                        id integer PRIMARY KEY AUTOINCREMENT,
+                        from_id varchar(%i) NOT NULL,
+                        to_id varchar(%i) NOT NULL,
+                        type int NOT NULL,
+                        size int NOT NULL,
+                        received int NOT NULL DEFAULT 0,
+                        message_id int NOT NULL DEFAULT 0,
+                        created timestamp DEFAULT CURRENT_TIMESTAMP,
+                        FOREIGN KEY(from_id) REFERENCES clients(id),
+                        FOREIGN KEY(to_id) REFERENCES clients(id)
+                    )
+                """ % (
+                    pt_types.ClientID.SIZE,
+                    pt_types.ClientID.SIZE,
+                )), )
+            # The transfers of a database from before they expired have
+            # no creation time, they expire right away (0 precedes any date).
+            if 'created' not in (column for (_, column, *_) in
+                                 self._conn.execute(
+                                     'PRAGMA table_info(transfers)')):
+                self._conn.execute(
+                    'ALTER TABLE transfers ADD COLUMN created timestamp DEFAULT 0'
+                )
+            self._conn.execute(
+                'CREATE INDEX IF NOT EXISTS transfers_created ON transfers(created)'
+            )
+            self._conn.execute(
+                textwrap.dedent("""
+                    CREATE TABLE IF NOT EXISTS transfer_parts(
+                        transfer_id int NOT NULL,
+                        offset int NOT NULL,
+                        content blob NOT NULL,
+                        PRIMARY KEY(transfer_id, offset),
+                        FOREIGN KEY(transfer_id) REFERENCES transfers(id)
+                    )
+                """), )
+            # The messages whose content is in the blob store, with an
+            # empty content in the messages table, and their digest
+            self._conn.execute(
+                textwrap.dedent("""
+                    CREATE TABLE IF NOT EXISTS message_blobs(
+                        message_id integer NOT NULL,
+                        digest text NOT NULL,
+                        PRIMARY KEY(message_id),
+                        FOREIGN KEY(message_id) REFERENCES messages(id)
+                    )
+                """), )
+            self._conn.execute(
+                'CREATE INDEX IF NOT EXISTS message_blobs_digest ON message_blobs(digest)'
+            )
+        self._expire_transfers()
+        # The contents that were left behind, if the server stopped
+        # in the middle of inserting or deleting a message
+        self._blobs.collect([
+            digest for (digest, ) in self._conn.execute(
+                'SELECT digest FROM message_blobs')
+        ])
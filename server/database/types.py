@@ -27,3 +27,22 @@ class Message():
         self.to_client = to_client
         self.type = message_type
         self.content = content
+
+
+class Transfer():
+    """A message whose content is sent in parts
+
+    Once all of the content was received, the transfer
+    becomes a message, and holds its id (0 until then).
+    """
+    def __init__(self, transfer_id: types.MessageID,
+                 from_id: types.ClientID, to_id: types.ClientID,
+                 message_type: types.MessageType, size: types.MessageSize,
+                 received: types.MessageSize, message_id: types.MessageID):
+        self.id = transfer_id  # it's a good name; pylint: disable=C0103
+        self.from_id = from_id
+        self.to_id = to_id
+        self.type = message_type
+        self.size = size
+        self.received = received
+        self.message_id = message_id
@@ -29,11 +29,17 @@ def main():
     try:
         database = sqlite3_engine.Sqlite3Engine(config.DATABASE_NAME)
         with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as sock:
+            # keep-alive connections that were open when the server went
+            # down shouldn't prevent it from starting again.
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
             sock.bind(('', port))
             sock.listen()
             logging.info('Server starts listening on port %i', port)
             while True:
                 conn, addr = sock.accept()
+                # responses are written in several pieces, on a keep-alive
+                # connection the client shouldn't wait for an ack between them
+                conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
                 logging.info('New connection from %s', addr)
                 connection.Connection(database, conn).start()  # auto detaching
     except Exception as err:  # pylint: disable=broad-except
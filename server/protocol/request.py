@@ -9,6 +9,7 @@
 
 from __future__ import annotations
 
+from typing import List
 from io import BytesIO
 
 from protocol import types
@@ -19,6 +20,10 @@ import config
 
 
 class Header():
+    # Requests of this version (or above) ask the server to keep
+    # the connection open, and wait for another request once it responds.
+    KEEP_ALIVE_VERSION = 3
+
     def __init__(self, client_id: types.ClientID, version: types.Version,
                  code: types.Code, payload_size: types.PayloadSize):
         self.client_id = client_id
@@ -26,6 +31,10 @@ class Header():
         self.code = code
         self.payload_size = payload_size
 
+    @property
+    def keep_alive(self) -> bool:
+        return self.version.value >= self.KEEP_ALIVE_VERSION
+
     @classmethod
     def read(cls, sock: utils.Socket) -> Header:
         data = BytesIO(
@@ -61,6 +70,33 @@ class ClientList():
     CODE = 1101
 
 
+class ClientListSince():
+    """Asks only for the clients that were seen since a given time"""
+    CODE = 1105
+    SIZE = types.Timestamp.SIZE
+
+    def __init__(self, since: types.Timestamp):
+        self.since = since
+
+    @classmethod
+    def read(cls, sock: utils.Socket,
+             expected_size: types.PayloadSize) -> ClientListSince:
+        """
+        Args:
+            sock: the socket to read from the data
+            expected_size: the expected size of the payload
+
+        Raises:
+            protocol.exceptions.MessageSizeMismatch: the payload is not
+                the size of the request
+        """
+        if expected_size.value != cls.SIZE:
+            raise exceptions.MessageSizeMismatch(expected_size,
+                                                 types.PayloadSize(cls.SIZE))
+        data = BytesIO(sock.recv(cls.SIZE, True))
+        return ClientListSince(types.Timestamp.read(data))
+
+
 class PublicKey():
     CODE = 1102
 
@@ -106,7 +142,7 @@ class SendMessage():
         if message_type.value not in types.MessageType.SUPPORT_VALUES:
             raise exceptions.MessageTypeError(message_type.value)
 
-        content_generator = (sock.recv(chunk_size)
+        content_generator = (sock.recv(chunk_size, True)
                              for chunk_size in utils.get_chunk_sizes(
                                  message_size.value, config.DATA_CHUNK_SIZE))
         return SendMessage(
@@ -116,5 +152,195 @@ class SendMessage():
         )
 
 
+class SendMessageBatch():
+    """Several messages in a single request, each to its own receiver
+
+    The messages follow each other, each in the layout of SendMessage.
+    """
+    CODE = 1108
+
+    def __init__(self, messages: List[SendMessage]):
+        self.messages = messages
+
+    @classmethod
+    def read(cls, sock: utils.Socket,
+             expected_size: types.PayloadSize) -> SendMessageBatch:
+        """
+        Args:
+            sock: the socket to read from the data
+            expected_size: the expected size of the payload
+
+        Raises:
+            protocol.exceptions.MessageTypeError: a message type is unknown
+            protocol.exceptions.MessageSizeMismatch: a message size is too big / small
+        """
+        header_size = (types.ClientID.SIZE + types.MessageType.SIZE +
+                       types.MessageSize.SIZE)
+        messages = []
+        left = expected_size.value
+        while left:
+            if left < header_size:
+                raise exceptions.MessageSizeMismatch(
+                    expected_size,
+                    types.PayloadSize(expected_size.value - left +
+                                      header_size))
+            data = BytesIO(sock.recv(header_size, True))
+            receiver_id = types.ClientID.read(data)
+            message_type = types.MessageType.read(data)
+            message_size = types.MessageSize.read(data)
+            left -= header_size
+            if message_size.value > left:
+                raise exceptions.MessageSizeMismatch(
+                    expected_size,
+                    types.PayloadSize(expected_size.value - left +
+                                      message_size.value))
+            if message_type.value not in types.MessageType.SUPPORT_VALUES:
+                raise exceptions.MessageTypeError(message_type.value)
+
+            content_generator = (sock.recv(chunk_size, True)
+                                 for chunk_size in utils.get_chunk_sizes(
+                                     message_size.value,
+                                     config.DATA_CHUNK_SIZE))
+            messages.append(
+                SendMessage(
+                    receiver_id,
+                    message_type,
+                    types.MessageContent.read(content_generator),
+                ))
+            left -= message_size.value
+        return SendMessageBatch(messages)
+
+
+class SendMessagePart():
+    """A part of a message content, that is sent on its own
+
+    The parts of a content are collected into a transfer, which
+    becomes a message once all of its content arrived.
+    A transfer id of zero starts a new transfer.
+    """
+    CODE = 1106
+    HEADER_SIZE = (types.ClientID.SIZE + types.MessageType.SIZE +
+                   types.MessageSize.SIZE + types.MessageID.SIZE +
+                   types.MessageSize.SIZE)
+
+    def __init__(self, receiver_id: types.ClientID,
+                 message_type: types.MessageType,
+                 message_size: types.MessageSize,
+                 transfer_id: types.MessageID, offset: types.MessageSize,
+                 part: types.MessageContent):
+        self.receiver_id = receiver_id
+        self.message_type = message_type
+        self.message_size = message_size
+        self.transfer_id = transfer_id
+        self.offset = offset
+        self.part = part
+
+    @classmethod
+    def read(cls, sock: utils.Socket,
+             expected_size: types.PayloadSize) -> SendMessagePart:
+        """
+        Args:
+            sock: the socket to read from the data
+            expected_size: the expected size of the payload
+
+        Raises:
+            protocol.exceptions.MessageTypeError: the message type is unknown
+            protocol.exceptions.MessageSizeMismatch: the part is too big / small
+        """
+        if not cls.HEADER_SIZE <= expected_size.value <= (
+                cls.HEADER_SIZE + config.MAX_MESSAGE_PART_SIZE):
+            raise exceptions.MessageSizeMismatch(
+                expected_size, types.PayloadSize(cls.HEADER_SIZE))
+        data = BytesIO(sock.recv(cls.HEADER_SIZE, True))
+        receiver_id = types.ClientID.read(data)
+        message_type = types.MessageType.read(data)
+        message_size = types.MessageSize.read(data)
+        transfer_id = types.MessageID.read(data)
+        offset = types.MessageSize.read(data)
+        if message_type.value not in types.MessageType.SUPPORT_VALUES:
+            raise exceptions.MessageTypeError(message_type.value)
+
+        part_generator = (sock.recv(chunk_size, True)
+                          for chunk_size in utils.get_chunk_sizes(
+                              expected_size.value - cls.HEADER_SIZE,
+                              config.DATA_CHUNK_SIZE))
+        return SendMessagePart(
+            receiver_id,
+            message_type,
+            message_size,
+            transfer_id,
+            offset,
+            types.MessageContent.read(part_generator),
+        )
+
+
 class PendingMessages():
     CODE = 1104
+
+
+class PendingMessagesFrom():
+    """Asks for the pending messages, starting from a given message
+
+    The messages that precede it were already received, and the
+    content of the message itself is sent starting from the offset.
+    """
+    CODE = 1107
+    SIZE = types.MessageID.SIZE + types.MessageSize.SIZE
+
+    def __init__(self, message_id: types.MessageID, offset: types.MessageSize):
+        self.message_id = message_id
+        self.offset = offset
+
+    @classmethod
+    def read(cls, sock: utils.Socket,
+             expected_size: types.PayloadSize) -> PendingMessagesFrom:
+        """
+        Args:
+            sock: the socket to read from the data
+            expected_size: the expected size of the payload
+
+        Raises:
+            protocol.exceptions.MessageSizeMismatch: the payload is not
+                the size of the request
+        """
+        if expected_size.value != cls.SIZE:
+            raise exceptions.MessageSizeMismatch(expected_size,
+                                                 types.PayloadSize(cls.SIZE))
+        data = BytesIO(sock.recv(cls.SIZE, True))
+        return PendingMessagesFrom(
+            types.MessageID.read(data),
+            types.MessageSize.read(data),
+        )
+
+
+class SubscribePendingMessages():
+    """Subscribes to the pending messages, starting from a given message
+
+    The connection stays open, and the messages are pushed over it in
+    batches, as they arrive. The receiver confirms each batch with the id
+    of the first message it didn't receive yet (a bare MessageID), before
+    the next batch is sent. A batch with no messages is a heartbeat.
+    """
+    CODE = 1109
+    SIZE = types.MessageID.SIZE
+
+    def __init__(self, message_id: types.MessageID):
+        self.message_id = message_id
+
+    @classmethod
+    def read(cls, sock: utils.Socket,
+             expected_size: types.PayloadSize) -> SubscribePendingMessages:
+        """
+        Args:
+            sock: the socket to read from the data
+            expected_size: the expected size of the payload
+
+        Raises:
+            protocol.exceptions.MessageSizeMismatch: the payload is not
+                the size of the request
+        """
+        if expected_size.value != cls.SIZE:
+            raise exceptions.MessageSizeMismatch(expected_size,
+                                                 types.PayloadSize(cls.SIZE))
+        data = BytesIO(sock.recv(cls.SIZE, True))
+        return SubscribePendingMessages(types.MessageID.read(data))
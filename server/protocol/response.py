@@ -9,7 +9,7 @@
 
 from __future__ import annotations
 from abc import ABC, abstractmethod
-from typing import Iterator
+from typing import Callable, Iterator, List, Tuple
 
 from protocol import types
 
@@ -26,6 +26,9 @@ class ResponseSchema(ABC):
             An iterator that yields the response in chunks of raw_data.
         """
 
+    def sent(self) -> None:
+        """Called once the whole response was sent to the client"""
+
 
 class Header(ResponseSchema):
     # The version defines what the protocol supports,
@@ -82,6 +85,28 @@ class ClientList(Header):
             yield chunk
 
 
+class ClientListSince(Header):
+    """A client list, preceded by the version of the list
+
+    The version should be sent back with the next request,
+    to receive only the clients that changed since this list.
+    """
+    CODE = 2105
+
+    def __init__(self, version: types.Timestamp, payload: Iterator[bytes],
+                 payload_size: types.PayloadSize):
+        super().__init__(self.CODE, types.Timestamp.SIZE + payload_size)
+        self._list_version = version
+        self._payload = payload
+
+    def write(self) -> Iterator[bytes]:
+        for chunk in super().write():
+            yield chunk
+        yield self._list_version.write()
+        for chunk in self._payload:
+            yield chunk
+
+
 class PublicKey(Header):
     CODE = 2102
 
@@ -110,36 +135,98 @@ class MessageSent(Header):
         yield self._client_id.write() + self._message_id.write()
 
 
+class MessageBatchSent(Header):
+    """A MessageSent for each of the messages of a batch, in the same order"""
+    CODE = 2108
+    NODE_SIZE = types.ClientID.SIZE + types.MessageID.SIZE
+
+    def __init__(self, messages: List[Tuple[types.ClientID,
+                                            types.MessageID]]):
+        super().__init__(self.CODE, self.NODE_SIZE * len(messages))
+        self._messages = messages
+
+    def write(self) -> Iterator[bytes]:
+        for chunk in super().write():
+            yield chunk
+        yield b''.join(client_id.write() + message_id.write()
+                       for client_id, message_id in self._messages)
+
+
+class MessagePartReceived(Header):
+    """The state of a transfer, after a part of it was received
+
+    Holds the amount of bytes of the content that were received so far,
+    and the id of the message once all of the content was received (or 0).
+    """
+    CODE = 2106
+
+    def __init__(self, client_id: types.ClientID,
+                 transfer_id: types.MessageID, received: types.MessageSize,
+                 message_id: types.MessageID):
+        super().__init__(
+            self.CODE, types.ClientID.SIZE + types.MessageID.SIZE +
+            types.MessageSize.SIZE + types.MessageID.SIZE)
+        self._client_id = client_id
+        self._transfer_id = transfer_id
+        self._received = received
+        self._message_id = message_id
+
+    def write(self) -> Iterator[bytes]:
+        for chunk in super().write():
+            yield chunk
+        yield (self._client_id.write() + self._transfer_id.write() +
+               self._received.write() + self._message_id.write())
+
+
 class Message():
-    """Represents a single message"""
+    """Represents a single message
+
+    A message may be sent without the start of its content,
+    in which case the size it holds is the size of the rest of it.
+    """
     HEADER_SIZE = types.ClientID.SIZE + types.MessageID.SIZE + types.MessageType.SIZE
 
-    def __init__(self, sender_id: types.ClientID, message_id: types.MessageID,
+    def __init__(self,
+                 sender_id: types.ClientID,
+                 message_id: types.MessageID,
                  message_type: types.MessageType,
-                 content: types.MessageContent):
+                 content: types.MessageContent,
+                 offset: int = 0):
         self._sender_id = sender_id
         self._message_id = message_id
         self._message_type = message_type
         self._content = content
+        self._offset = min(offset, content.size.value)
 
     def get_size(self):
         """returns the size of this message"""
-        return self.HEADER_SIZE + self._content.size.value
+        return self.HEADER_SIZE + self._content.size.value - self._offset
 
     def write(self) -> Iterator[bytes]:
         yield (self._sender_id.write() + self._message_id.write() +
-               self._message_type.write() + self._content.size.write())
-        for chunk in self._content.write_by_chunks(config.DATA_CHUNK_SIZE):
+               self._message_type.write() +
+               types.MessageSize(self._content.size.value -
+                                 self._offset).write())
+        for chunk in self._content.write_by_chunks(config.DATA_CHUNK_SIZE,
+                                                   self._offset):
             yield chunk
 
 
 class PendingMessages(Header):
+    """The pending messages, in the order they were sent
+
+    'on_sent' is called once the whole response was sent, since the
+    messages should only be deleted once the receiver has them.
+    """
     CODE = 2104
 
-    def __init__(self, payload: Iterator[bytes],
-                 payload_size: types.PayloadSize):
+    def __init__(self,
+                 payload: Iterator[bytes],
+                 payload_size: types.PayloadSize,
+                 on_sent: Callable[[], None] = lambda: None):
         super().__init__(self.CODE, payload_size)
         self._payload = payload
+        self._on_sent = on_sent
 
     def write(self) -> Iterator[bytes]:
         for chunk in super().write():
@@ -147,6 +234,17 @@ class PendingMessages(Header):
         for chunk in self._payload:
             yield chunk
 
+    def sent(self) -> None:
+        self._on_sent()
+
+    def empty(self) -> bool:
+        """Whether there are no messages in the response"""
+        return not self._payload_size.value
+
+    def size(self) -> int:
+        """The size of the messages in the response, in bytes"""
+        return self._payload_size.value
+
 
 class Error(Header):
     CODE = 9000
@@ -124,6 +124,29 @@ class PayloadSize(TypeSchema):
         return PayloadSize(value)
 
 
+class Timestamp(TypeSchema):
+    """Seconds since the unix epoch"""
+    SIZE = 8
+    TYPE = 'Q'
+
+    def __init__(self, value):
+        self.value = value
+
+    def write(self) -> bytes:
+        return struct.pack(PROTOCOL_ORIENTATION + self.TYPE, self.value)
+
+    def __str__(self) -> str:
+        return '%s(%s)' % (self.__class__.__name__, self.value)
+
+    @classmethod
+    def read(cls, data: io.BytesIO) -> Timestamp:
+        (value, ) = struct.unpack(
+            PROTOCOL_ORIENTATION + cls.TYPE,
+            data.read(cls.SIZE),
+        )
+        return Timestamp(value)
+
+
 class Username(TypeSchema):
     SIZE = 255
     TYPE = '%is' % SIZE
@@ -193,7 +216,7 @@ class MessageID(TypeSchema):
 class MessageType(TypeSchema):
     SIZE = 1
     TYPE = 'B'
-    SUPPORT_VALUES = [1, 2, 3, 4]
+    SUPPORT_VALUES = [1, 2, 3, 4, 5]
 
     def __init__(self, value):
         self.value = value
@@ -251,14 +274,17 @@ class MessageContent(TypeSchema):
         """Extremley inefficient, prefer using write_by_chunks"""
         return self.value.read()
 
-    def write_by_chunks(self, chunk_size: int) -> Iterator[bytes]:
+    def write_by_chunks(self,
+                        chunk_size: int,
+                        offset: int = 0) -> Iterator[bytes]:
         """Returns the data in chunks
 
         Args:
             chunk_size: the maximum amount of bytes in each chunk
+            offset: the amount of bytes to skip at the start of the data
         """
         assert chunk_size > 0, "can't return chunks of negative amount of bytes"
-        self.value.seek(0)
+        self.value.seek(offset)
         while True:
             chunk = self.value.read(chunk_size)
             if not chunk:
@@ -39,22 +39,32 @@ class Socket():
                 of bytes from the stream.
         """
         if blocking:
-            data = bytes()
+            # read straight into a single buffer, instead of
+            # concatenating the pieces over and over again
+            data = bytearray(count)
+            view = memoryview(data)
             recv_count = 0
             while recv_count < count:
-                new_data = self._base_sock.recv(count - recv_count)
-                if not new_data:
+                new_count = self._base_sock.recv_into(view[recv_count:])
+                if not new_count:
                     raise EOFError(
                         'failed to read %i bytes from the socket connection' %
                         (count - recv_count))
-                data += new_data
-                recv_count = len(data)
-            return data
+                recv_count += new_count
+            return bytes(data)
         return self._base_sock.recv(count)
 
     def send(self, data: bytes) -> None:
         """Send bytes over the connection"""
-        return self._base_sock.send(data)
+        return self._base_sock.sendall(data)
+
+    def settimeout(self, timeout: float) -> None:
+        """Limits the amount of seconds a single operation may block"""
+        self._base_sock.settimeout(timeout)
+
+    def close(self) -> None:
+        """Closes the connection"""
+        self._base_sock.close()
 
 
 def get_chunk_sizes(total_size: int, chunk_size: int) -> Iterator[int]: